@@ -0,0 +1,213 @@
+/**
+ *  Copyright (C) 2005 Benjamin C Meyer (ben at meyerhome dot net)
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; see the file COPYING.LIB.  If not, write to
+ *  the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ *  Boston, MA 02111-1307, USA.
+ */
+
+/**
+ * Packed binary maze format shared by genmaze and solmaze.
+ *
+ * A cell only needs two bits, if it is open to the right and if it is open
+ * going down.  Up and left are the down and right bits of the neighbours.
+ *
+ * The file is a 44 byte header followed by the rows from top to bottom.  Each
+ * row is (width + 3) / 4 bytes, cell x is in byte x / 4 at bit (x % 4) * 2.
+ * All header numbers are 32 bit little endian:
+ *
+ *    0  magic "AMZP"
+ *    4  version (MAZEFILE_VERSION)
+ *    8  flags
+ *   12  width
+ *   16  height
+ *   20  start x, start y (the bottom left cell)
+ *   28  end x, end y (the top right cell)
+ *   36  checksum of the rows (FNV-1a)
+ *   40  reserved (0)
+ *
+ * When the maze is written somewhere that can't be seeked back to (a pipe)
+ * the checksum isn't known when the header goes out.  Then MAZEFILE_TRAILER is
+ * set and the checksum follows the last row as 4 more bytes instead.
+ *
+ * A solved path can be written on its own as just the moves from the start
+ * to the end, two bits each packed four to a byte the same way as the cells
+ * (move i is in byte i / 4 at bit (i % 4) * 2), after a 24 byte header:
+ *
+ *    0  magic "AMZS"
+ *    4  version (MAZEPATH_VERSION)
+ *    8  start x, start y
+ *   16  number of moves (64 bit little endian)
+ */
+
+#ifndef MAZEFILE_H
+#define MAZEFILE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+
+#define MAZEFILE_MAGIC "AMZP"
+#define MAZEFILE_VERSION 1
+#define MAZEFILE_HEADERSIZE 44
+
+// The two bits stored for each cell
+#define MAZEFILE_RIGHT 1
+#define MAZEFILE_DOWN  2
+
+// Header flags
+#define MAZEFILE_TRAILER 1
+
+#define MAZEFILE_CHECKSUM_INIT 2166136261U
+
+struct MazeFileHeader {
+    uint32_t version;
+    uint32_t flags;
+    uint32_t width, height;
+    uint32_t startX, startY;
+    uint32_t endX, endY;
+    uint32_t checksum;
+};
+
+/**
+ * @return the number of bytes in one packed row
+ */
+inline size_t mazeFileRowBytes(uint32_t width)
+{
+    return ((size_t) width + 3) / 4;
+}
+
+/**
+ * @return the number of bytes in the whole packed maze h is the header of
+ */
+inline size_t mazeFileSize(const MazeFileHeader *h)
+{
+    return MAZEFILE_HEADERSIZE + mazeFileRowBytes(h->width) * h->height
+        + ((h->flags & MAZEFILE_TRAILER) ? 4 : 0);
+}
+
+/**
+ * Add len bytes of data to the running checksum sum.
+ */
+inline uint32_t mazeFileChecksum(uint32_t sum, const unsigned char *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        sum ^= data[i];
+        sum *= 16777619U;
+    }
+    return sum;
+}
+
+inline void mazeFilePut32(unsigned char *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+inline uint32_t mazeFileGet32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ * Fill in a header for a maze of width by height running from the bottom
+ * left to the top right.
+ */
+inline void mazeFileInitHeader(MazeFileHeader *h, uint32_t width, uint32_t height)
+{
+    h->version = MAZEFILE_VERSION;
+    h->flags = 0;
+    h->width = width;
+    h->height = height;
+    h->startX = 0;
+    h->startY = height - 1;
+    h->endX = width - 1;
+    h->endY = 0;
+    h->checksum = 0;
+}
+
+/**
+ * Write header h into out (MAZEFILE_HEADERSIZE bytes).
+ */
+inline void mazeFileWriteHeader(unsigned char *out, const MazeFileHeader *h)
+{
+    memcpy(out, MAZEFILE_MAGIC, 4);
+    mazeFilePut32(out + 4, h->version);
+    mazeFilePut32(out + 8, h->flags);
+    mazeFilePut32(out + 12, h->width);
+    mazeFilePut32(out + 16, h->height);
+    mazeFilePut32(out + 20, h->startX);
+    mazeFilePut32(out + 24, h->startY);
+    mazeFilePut32(out + 28, h->endX);
+    mazeFilePut32(out + 32, h->endY);
+    mazeFilePut32(out + 36, h->checksum);
+    mazeFilePut32(out + 40, 0);
+}
+
+/**
+ * @return true if data starts with the packed maze magic
+ */
+inline bool mazeFileIsPacked(const unsigned char *data, size_t len)
+{
+    return len >= 4 && 0 == memcmp(data, MAZEFILE_MAGIC, 4);
+}
+
+/**
+ * Read a header from in (MAZEFILE_HEADERSIZE bytes) into h.
+ * @return false if it isn't a header this version understands
+ */
+inline bool mazeFileReadHeader(const unsigned char *in, MazeFileHeader *h)
+{
+    if (!mazeFileIsPacked(in, MAZEFILE_HEADERSIZE))
+        return false;
+    h->version = mazeFileGet32(in + 4);
+    h->flags = mazeFileGet32(in + 8);
+    h->width = mazeFileGet32(in + 12);
+    h->height = mazeFileGet32(in + 16);
+    h->startX = mazeFileGet32(in + 20);
+    h->startY = mazeFileGet32(in + 24);
+    h->endX = mazeFileGet32(in + 28);
+    h->endY = mazeFileGet32(in + 32);
+    h->checksum = mazeFileGet32(in + 36);
+    return h->version == MAZEFILE_VERSION && h->width > 0 && h->height > 0;
+}
+
+#define MAZEPATH_MAGIC "AMZS"
+#define MAZEPATH_VERSION 1
+#define MAZEPATH_HEADERSIZE 24
+
+// The four moves a path can make
+#define MAZEPATH_UP    0
+#define MAZEPATH_DOWN  1
+#define MAZEPATH_LEFT  2
+#define MAZEPATH_RIGHT 3
+
+/**
+ * Write the header of a path of moves moves from (startX,startY) into out
+ * (MAZEPATH_HEADERSIZE bytes).
+ */
+inline void mazePathWriteHeader(unsigned char *out, uint32_t startX,
+                                uint32_t startY, uint64_t moves)
+{
+    memcpy(out, MAZEPATH_MAGIC, 4);
+    mazeFilePut32(out + 4, MAZEPATH_VERSION);
+    mazeFilePut32(out + 8, startX);
+    mazeFilePut32(out + 12, startY);
+    mazeFilePut32(out + 16, (uint32_t) moves);
+    mazeFilePut32(out + 20, (uint32_t) (moves >> 32));
+}
+
+#endif // MAZEFILE_H
@@ -0,0 +1,253 @@
+/**
+ *  Copyright (C) 2005 Benjamin C Meyer (ben at meyerhome dot net)
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; see the file COPYING.LIB.  If not, write to
+ *  the Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ *  Boston, MA 02111-1307, USA.
+ */
+
+/**
+ * GenBench - Measures how fast genmaze makes and draws mazes
+ *
+ * For every width, height and output style asked for this times making the
+ * rows with Eller's algorithm (Eller::makeRow) and drawing rows with the
+ * renderers separately so a slow down in either one can be told apart.
+ *
+ * Drawing is timed on rows that were made ahead of time (the first
+ * SAMPLEROWS rows of the maze are drawn over and over) and written to
+ * /dev/null.
+ *
+ * Each case is run in its own process so the peak memory reported is only
+ * that case's.  Results go to stdout as CSV (or JSON with --json).
+ */
+
+#define GENMAZE_NO_MAIN
+#include "genmaze.cpp"
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// Rows kept around to be drawn in the render timing
+#define SAMPLEROWS 64
+
+// Cells to make in each case when no heights are given
+#define DEFAULTCELLS 10000000
+
+struct BenchResult {
+    double generateNs;
+    double renderNs;
+    uint64_t renderBytes;
+    long peakRss;
+};
+
+/**
+ * @return the current time in nanoseconds
+ */
+double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+/**
+ * Time making and drawing a maze of width by rows in style type.
+ */
+BenchResult runCase(uint rows, MAZETYPE type)
+{
+    BenchResult result;
+    Eller e;
+    e.init(width, false);
+    e.rng.seed(1);
+
+    uint sampleCount = rows < SAMPLEROWS ? rows : SAMPLEROWS;
+    cell *sample = new cell[(size_t)sampleCount * width];
+
+    // Generation only
+    double start = now();
+    for (uint i = 0; i < rows; i++) {
+        e.makeRow(i == rows - 1);
+        if (i < sampleCount)
+            memcpy(sample + (size_t)i * width, e.row, width);
+    }
+    result.generateNs = now() - start;
+
+    // Render only
+    output = fopen("/dev/null", "w");
+    outputBytes = 0;
+    initOutput();
+    start = now();
+    if (type == PACKED)
+        beginPacked(rows);
+    for (uint i = 0; i < rows; i++) {
+        const cell *r = sample + (size_t)(i % sampleCount) * width;
+        outputRow(type, r, NULL, i == rows - 1, i == 0);
+    }
+    if (type == PACKED)
+        endPacked();
+    flushOutput();
+    result.renderNs = now() - start;
+    result.renderBytes = outputBytes;
+    fclose(output);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    result.peakRss = usage.ru_maxrss;
+
+    delete[]outBuffer;
+    delete[]sample;
+    e.cleanup();
+    return result;
+}
+
+/**
+ * Parse a comma separated list of numbers from s into list.
+ * @return how many numbers were found
+ */
+int parseList(const char *s, uint *list, int max)
+{
+    int count = 0;
+    while (*s && count < max) {
+        char *end;
+        list[count++] = strtoul(s, &end, 10);
+        if (*end != ',')
+            break;
+        s = end + 1;
+    }
+    return count;
+}
+
+/**
+ * Run all of the cases and print out the results.
+ */
+int main(int argc, char *argv[])
+{
+    uint widths[32] = { 10, 100, 1000, 10000, 100000, 1000000 };
+    int widthCount = 6;
+    uint heights[32];
+    int heightCount = 0;
+    uint64_t cells = DEFAULTCELLS;
+    const char *modes = "abp";
+    bool json = false;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (0 == strcmp(argv[i], "--widths") && hasValue)
+            widthCount = parseList(argv[++i], widths, 32);
+        else if (0 == strcmp(argv[i], "--heights") && hasValue)
+            heightCount = parseList(argv[++i], heights, 32);
+        else if (0 == strcmp(argv[i], "--cells") && hasValue)
+            cells = strtoull(argv[++i], NULL, 10);
+        else if (0 == strcmp(argv[i], "--modes") && hasValue)
+            modes = argv[++i];
+        else if (0 == strcmp(argv[i], "--json"))
+            json = true;
+        else {
+            fprintf(stderr, "Usage: %s [OPTIONS]\n", argv[0]);
+            fprintf(stderr, "\t--widths W,W,...  - Widths to try "
+                            "(default 10 to 1000000).\n");
+            fprintf(stderr, "\t--heights H,H,... - Heights to try (default "
+                            "enough rows for --cells cells).\n");
+            fprintf(stderr, "\t--cells N         - Cells in each case when no "
+                            "heights are given (default %d).\n", DEFAULTCELLS);
+            fprintf(stderr, "\t--modes abp       - Output styles to draw, "
+                            "a ASCII, b BLOCK, p packed.\n");
+            fprintf(stderr, "\t--json            - Print JSON instead of CSV.\n");
+            return 1;
+        }
+    }
+
+    if (json)
+        printf("[\n");
+    else
+        printf("mode,width,height,cells,generate_ns,generate_cells_per_sec,"
+               "generate_ns_per_row,render_ns,render_bytes,"
+               "render_bytes_per_sec,render_ns_per_row,peak_rss_kb\n");
+    fflush(stdout);
+
+    bool firstResult = true;
+    for (int w = 0; w < widthCount; w++) {
+        if (widths[w] == 0)
+            continue;
+        int caseHeights = heightCount > 0 ? heightCount : 1;
+        for (int h = 0; h < caseHeights; h++) {
+            uint rows = heightCount > 0 ? heights[h] : cells / widths[w];
+            if (rows == 0)
+                rows = 1;
+            for (const char *m = modes; *m; m++) {
+                MAZETYPE type;
+                if (*m == 'a')
+                    type = ASCII;
+                else if (*m == 'b')
+                    type = BLOCK;
+                else if (*m == 'p')
+                    type = PACKED;
+                else
+                    continue;
+
+                int fds[2];
+                if (pipe(fds) != 0) {
+                    perror("pipe");
+                    return 1;
+                }
+                pid_t pid = fork();
+                if (pid == 0) {
+                    close(fds[0]);
+                    width = widths[w];
+                    BenchResult r = runCase(rows, type);
+                    ssize_t written = write(fds[1], &r, sizeof(r));
+                    _exit(written == sizeof(r) ? 0 : 1);
+                }
+                close(fds[1]);
+                BenchResult r;
+                bool ok = read(fds[0], &r, sizeof(r)) == sizeof(r);
+                close(fds[0]);
+                waitpid(pid, NULL, 0);
+                if (!ok) {
+                    fprintf(stderr, "Case %c %u x %u failed.\n", *m, widths[w], rows);
+                    continue;
+                }
+
+                double cellCount = (double)widths[w] * rows;
+                if (json) {
+                    printf("%s  {\"mode\": \"%c\", \"width\": %u, \"height\": %u, "
+                           "\"cells\": %.0f, \"generate_ns\": %.0f, "
+                           "\"generate_cells_per_sec\": %.0f, "
+                           "\"generate_ns_per_row\": %.1f, \"render_ns\": %.0f, "
+                           "\"render_bytes\": %llu, \"render_bytes_per_sec\": %.0f, "
+                           "\"render_ns_per_row\": %.1f, \"peak_rss_kb\": %ld}",
+                           firstResult ? "" : ",\n", *m, widths[w], rows, cellCount,
+                           r.generateNs, cellCount / r.generateNs * 1e9,
+                           r.generateNs / rows, r.renderNs,
+                           (unsigned long long)r.renderBytes,
+                           r.renderBytes / r.renderNs * 1e9, r.renderNs / rows,
+                           r.peakRss);
+                } else {
+                    printf("%c,%u,%u,%.0f,%.0f,%.0f,%.1f,%.0f,%llu,%.0f,%.1f,%ld\n",
+                           *m, widths[w], rows, cellCount,
+                           r.generateNs, cellCount / r.generateNs * 1e9,
+                           r.generateNs / rows, r.renderNs,
+                           (unsigned long long)r.renderBytes,
+                           r.renderBytes / r.renderNs * 1e9, r.renderNs / rows,
+                           r.peakRss);
+                }
+                firstResult = false;
+                fflush(stdout);
+            }
+        }
+    }
+    if (json)
+        printf("\n]\n");
+    return 0;
+}
@@ -0,0 +1,5 @@
+CONFIG   = warn_on release thread
+SOURCES   = genbench.cpp
+TARGET    = genbench
+INCLUDEPATH += ../genmaze ../common
+DEPENDPATH += ../genmaze ../common
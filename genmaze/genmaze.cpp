@@ -27,9 +27,9 @@
  * one row at a time. Once a row is generated, the algorithm no longer 
  * needs it. 
  *
- * Unfortunately the ASCII output requires the last row be saved to properly 
- * generate that output so the implementation requires twice the memory
- * that it should.
+ * The ASCII output also needs to know which cells of the last row were open
+ * to the right.  Rather than keeping the last row around that one bit is
+ * carried over in each cell of the new row (ABOVERIGHT).
  * 
  * Each cell in a row is contained in a set, where two cells are in the same
  * set if there's a path between them through the part of the Maze that's been
@@ -52,13 +52,27 @@
  * Step 4) If it is the last row connect cells horizontally that are not in
  * the same set.
  *
+ * The sets of a row are kept as a disjoint-set forest (union by size with
+ * path compression) whose roots carry the set number and a count of cells
+ * going down.  Set numbers are recycled through a per number count so that
+ * the lowest free number can be found without searching the row.  Together
+ * this makes each row O(width) instead of O(width^2).
+ *
  */
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
 #include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+
+#include "mazefile.h"
 
 // The definition for what a block can be (or'd together).
 #define EMPTY 0
@@ -67,175 +81,314 @@
 #define LEFT  4
 #define RIGHT 8
 
+// Not a direction, marks a cell whose neighbour above is open to the RIGHT
+#define ABOVERIGHT 16
+
 // Whitespace buffer on left hand side of the maze
 #define BUFFER 5
 
-// At this point there are only two types, but abstracted a tiny bit for
-// possible future use.
-enum MAZETYPE { ASCII, BLOCK };
+// Marks a set number that has no cell in the row being built
+#define NOSET ((uint)-1)
 
-// Global variables
-uint *set;
-uint *previousRow;
-uint *row;
-uint width;
-// These two only shown with the ASCII output
-bool debugsets;
-bool debugrows;
+// Text mazes (ASCII, BLOCK) and the packed binary format from mazefile.h
+enum MAZETYPE { ASCII, BLOCK, PACKED };
+
+// How the maze is carved, see generateBands() and carveRow()
+enum ALGORITHM { ELLER, SIDEWINDER, BINARYTREE };
 
 /**
- * Draw a row for a maze that is block based with sharing colums.
- * 
- * This output style is here because it is very easy to output compared to ascii
- * and because the output takes up less room (for very large mazes). 
- * 
- * XXXXXXXXXXXXXXXXX
- * X               X
- * X XXX XXX XXXXX X
- * X   X X X X     X
- * XXX X X X X XXX X
- * X   X   X X   X X
- * XXXXXXXXXXXXXXXXX
+ * xoshiro256** random number generator.
  *
- *  @param isLast if this row is the last one.
+ * Used instead of rand() so that a seed gives the same maze on every
+ * platform.  Coin flips are handed out one bit at a time from a single 64 bit
+ * draw so the generator only runs once every 64 flips.
  */
-void outputBlock(bool isLast)
-{
-    // Top line
-    for (uint i = 0; i < width; i++)
-        printf((row[i] & UP) ? "X " : "XX");
-    printf("X\n");
+struct Random {
+    uint64_t s[4];
+    uint64_t bits;
+    uint bitsLeft;
 
-    // Middle line
-    for (uint i = 0; i < width; i++)
-        printf((row[i] & LEFT) ? "  " : "X ");
-    printf("X\n");
+    /**
+     * Reset the generator, the state is expanded from seed with splitmix64.
+     */
+    void seed(uint64_t seed)
+    {
+        for (int i = 0; i < 4; i++) {
+            seed += 0x9e3779b97f4a7c15ULL;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            s[i] = z ^ (z >> 31);
+        }
+        bits = 0;
+        bitsLeft = 0;
+    }
 
-    if (!isLast)
-        return;
+    static inline uint64_t rotl(uint64_t x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
 
-    // Bottom line
-    for (uint i = 0; i < width; i++)
-        printf("XX");
-    printf("X\n");
-}
+    /**
+     * @return the next 64 random bits
+     */
+    inline uint64_t next()
+    {
+        uint64_t result = rotl(s[1] * 5, 7) * 9;
+        uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    /**
+     * @return true half of the time
+     */
+    inline bool flip()
+    {
+        if (bitsLeft == 0) {
+            bits = next();
+            bitsLeft = 64;
+        }
+        bool heads = bits & 1;
+        bits >>= 1;
+        bitsLeft--;
+        return heads;
+    }
+};
+// A cell is the or'd directions it can move in
+typedef unsigned char cell;
 
 /**
- * Draw a row for a maze that is ascii based with sharing colums.
- * Place a buffer of size BUFFER to the left of the maze.
- *     ________________________
- *    |                       |
- *    |  ___    __    ______  |
- *    |     |  |  |  |        |
- *    |___  |  |  |  |  ___   |
- *    |     |     |  |     |  |
- *    |_____|_____|__|_____|__|
+ * The state Eller's algorithm carries from one row to the next.
  *
- * More complicated than outputBlock because it the top row char
- * will change depending on the cell in the previous row.
+ * The sets of a row are a disjoint-set forest over the cells, each root
+ * holding the set number in set[] and how many of its cells go down.
  *
- *  @param isLast if this row is the last one.
- *  @param isFirst if this row is the first one.
+ * When anchor is not NULL the generator also keeps track of which cells of
+ * its first row end up connected (used when gluing bands together).
+ * anchor[n] is a first row cell that set n reaches (or NOSET) and topParent
+ * is a disjoint-set forest over the first row.
  */
-void outputASCII(bool isLast, bool isFirst)
-{
-    // Top line
-    for (int i = 0; i < BUFFER; i++)
-        printf(" ");
+struct Eller {
+    uint width;
+    Random rng;
+    uint *set;
+    cell *row;
+    uint *parent;
+    uint *setSize;
+    uint *downCount;
+    // Indexed by set number, how many cells carry it and (while building)
+    // which cell is its root.  Set numbers never go above 2 * width.
+    uint *labelCount;
+    uint *setRoot;
+    uint *anchor;
+    uint *topParent;
+    // Rows made since reset()
+    uint rowCount;
+    // If the last row should join all of the remaining sets
+    bool closeLastRow;
 
-    printf(isFirst ? " " : "|");
-    for (uint r = 0; r < width; r++) {
-        printf((row[r] & UP) ? "  " : "__");
-        if (previousRow[r] & RIGHT && !(row[r] & RIGHT))
-            printf(" ");
-        else
-            printf(!isFirst && !(previousRow[r] & RIGHT) ? "|" : "_");
-    }
-    printf("\n");
+    void init(uint w, bool trackTop);
+    void reset();
+    void recount();
+    void cleanup();
+    inline uint findSet(uint c);
+    inline uint findTop(uint c);
+    void unionSet(uint a, uint b);
+    void makeRow(bool isLast);
+};
 
-    // Middle line
-    for (int i = 0; i < BUFFER; i++)
-        printf(" ");
+/**
+ * Allocate the row state for rows w cells wide and reset() it.
+ * @param trackTop if the first row connections should be tracked
+ */
+void Eller::init(uint w, bool trackTop)
+{
+    width = w;
+    set = new uint[width];
+    row = new cell[width];
+    parent = new uint[width];
+    setSize = new uint[width];
+    downCount = new uint[width];
+    labelCount = new uint[2 * width + 2];
+    setRoot = new uint[2 * width + 2];
+    anchor = trackTop ? new uint[2 * width + 2] : NULL;
+    topParent = trackTop ? new uint[width] : NULL;
+    closeLastRow = true;
+    reset();
+}
 
-    printf("|");
-    for (uint r = 0; r < width; r++) {
-        if (debugsets)
-            printf("%*d", 2, set[r]);
-        else if (debugrows)
-            printf("%*d", 2, row[r]);
-        else
-            printf("  ");
-        printf((row[r] & RIGHT) ? " " : "|");
+/**
+ * Get ready to make the first row of a new maze.
+ */
+void Eller::reset()
+{
+    for (uint i = 0; i < 2 * width + 2; i++) {
+        labelCount[i] = 0;
+        setRoot[i] = NOSET;
+        if (anchor)
+            anchor[i] = NOSET;
+    }
+    for (uint i = 0; i < width; i++) {
+        set[i] = i + width + 1;
+        labelCount[set[i]] = 1;
+        row[i] = 0;
+        if (topParent)
+            topParent[i] = i;
     }
-    printf("\n");
+    rowCount = 0;
+}
 
-    // If this is the last row in the maze then fill in the bottom line.
-    if (!isLast)
-        return;
+/**
+ * Recount how many cells carry each set number after set[] has been filled
+ * in from somewhere else.
+ */
+void Eller::recount()
+{
+    for (uint i = 0; i < 2 * width + 2; i++)
+        labelCount[i] = 0;
+    for (uint i = 0; i < width; i++)
+        labelCount[set[i]]++;
+}
+
+void Eller::cleanup()
+{
+    delete[]set;
+    delete[]row;
+    delete[]parent;
+    delete[]setSize;
+    delete[]downCount;
+    delete[]labelCount;
+    delete[]setRoot;
+    delete[]anchor;
+    delete[]topParent;
+}
 
-    for (int i = 0; i < BUFFER; i++)
-        printf(" ");
+/**
+ * Return the root cell of the set that cell c is in, compressing the path
+ * as it goes.
+ */
+inline uint Eller::findSet(uint c)
+{
+    uint root = c;
+    while (parent[root] != root)
+        root = parent[root];
+    while (parent[c] != root) {
+        uint next = parent[c];
+        parent[c] = root;
+        c = next;
+    }
+    return root;
+}
 
-    for (uint r = 0; r < width; r++) {
-        printf((row[r] & LEFT) ? "_" : "|");
-        printf("__");
+/**
+ * Return the representative of first row cell c.
+ */
+inline uint Eller::findTop(uint c)
+{
+    while (topParent[c] != c) {
+        topParent[c] = topParent[topParent[c]];
+        c = topParent[c];
     }
-    printf("|\n");
+    return c;
 }
 
 /**
- * Merge set b into set a in sets set
+ * Merge the set containing cell b into the set containing cell a.  The
+ * merged set keeps the set number of a (b's number is freed).
  */
-void unionSet(uint a, uint b)
+void Eller::unionSet(uint a, uint b)
 {
-    for (uint i = 0; i < width; i++) {
-        if (set[i] == b)
-            set[i] = a;
+    uint ra = findSet(a);
+    uint rb = findSet(b);
+    if (ra == rb)
+        return;
+
+    uint label = set[ra];
+    uint freed = set[rb];
+    labelCount[label] += labelCount[freed];
+    labelCount[freed] = 0;
+
+    if (anchor) {
+        if (anchor[freed] != NOSET) {
+            if (anchor[label] == NOSET)
+                anchor[label] = anchor[freed];
+            else
+                topParent[findTop(anchor[freed])] = findTop(anchor[label]);
+        }
+        anchor[freed] = NOSET;
+    }
+
+    // Union by size, the set number is carried by whichever root survives
+    if (setSize[ra] < setSize[rb]) {
+        uint t = ra;
+        ra = rb;
+        rb = t;
     }
+    parent[rb] = ra;
+    setSize[ra] += setSize[rb];
+    downCount[ra] += downCount[rb];
+    set[ra] = label;
 }
 
 /**
- * Create and print out a row.
- * @param isLast if this is the last row
+ * Create the next row.
+ * @param isLast if this is the last row (nothing goes down)
  */
-void makeRow(bool isLast)
+void Eller::makeRow(bool isLast)
 {
-    uint startingSetNum = 1;
-    // Make sure each cell is in a set and save the previousRow
+    uint freeLabel = 1;
+    // Make sure each cell is in a set and remember what was open to the right
     for (uint r = 0; r < width; r++) {
-        previousRow[r] = row[r];
+        cell aboveRight = (row[r] & RIGHT) ? ABOVERIGHT : 0;
         if ((row[r] & DOWN))
-            row[r] = UP;
+            row[r] = UP | aboveRight;
         else {
-            // Find the lowest set number that isn't already taken
-            bool foundNext = false;
-            while (!foundNext) {
-                bool found = false;
-                for (uint r = 0; r < width; r++) {
-                    if (set[r] == startingSetNum) {
-                        startingSetNum++;
-                        found = true;
-                        break;
-                    }
-                }
-                if (!found)
-                    foundNext = true;
-            }
-            set[r] = startingSetNum;
-            row[r] = EMPTY;
+            // Find the lowest set number that isn't already taken.  Numbers
+            // handed out in this row only grow so the search never restarts.
+            while (labelCount[freeLabel] != 0)
+                freeLabel++;
+            labelCount[set[r]]--;
+            set[r] = freeLabel;
+            labelCount[freeLabel]++;
+            row[r] = EMPTY | aboveRight;
+            if (anchor && rowCount == 0)
+                anchor[freeLabel] = r;
+        }
+    }
+
+    // Rebuild the disjoint sets for this row, cells that share a set number
+    // hang off of the first cell with that number.
+    for (uint r = 0; r < width; r++) {
+        uint first = setRoot[set[r]];
+        if (first == NOSET) {
+            setRoot[set[r]] = r;
+            first = r;
         }
+        parent[r] = first;
+        setSize[r] = 0;
+        downCount[r] = 0;
+    }
+    for (uint r = 0; r < width; r++) {
+        setSize[parent[r]]++;
+        setRoot[set[r]] = NOSET;
     }
 
     // Randomly fill in the cells with connections down or to the left
     for (uint i = 0; i < width; i++) {
-        if (rand() % 2 == 1) {
-            if (i > 0 && set[i] != set[i - 1]) {
+        if (rng.flip()) {
+            if (i > 0 && findSet(i) != findSet(i - 1)) {
                 row[i] |= LEFT;
                 row[i - 1] |= RIGHT;
-                unionSet(set[i], set[i - 1]);
+                unionSet(i, i - 1);
             }
         }
-        if ((rand() % 2 == 1) && !isLast) {
+        if (!isLast && rng.flip()) {
             row[i] |= DOWN;
         }
     }
@@ -243,112 +396,1491 @@ void makeRow(bool isLast)
     // If there are any sets that don't move down in this row,
     // make them go down.
     if (!isLast) {
+        for (uint r = 0; r < width; r++) {
+            if (row[r] & DOWN)
+                downCount[findSet(r)]++;
+        }
         for (uint r = 0; r < width; r++) {
             if (row[r] & DOWN)
                 continue;
-            uint mset = set[r];
-            bool goDown = true;
-            for (uint i = 0; i < width; i++) {
-                if (set[i] == mset && row[i] & DOWN) {
-                    goDown = false;
-                    break;
-                }
-            }
-            if (goDown) {
+            uint root = findSet(r);
+            if (downCount[root] == 0) {
                 row[r] |= DOWN;
+                downCount[root]++;
             }
         }
     }
 
     // last row, merge all sets so there is a path from any point
     // to any other point (sense they are all in one set)
-    if (isLast) {
+    if (isLast && closeLastRow) {
         for (uint r = 0; r < width - 1; r++) {
-            if (set[r] == set[r + 1])
+            if (findSet(r) == findSet(r + 1))
                 continue;
             row[r] |= RIGHT;
             row[r + 1] |= LEFT;
-            unionSet(set[r + 1], set[r]);
+            unionSet(r + 1, r);
         }
     }
+
+    // Hand every cell the number of its set for the next row (and debugging)
+    for (uint r = 0; r < width; r++)
+        set[r] = set[findSet(r)];
+    rowCount++;
 }
 
+// Global variables
+uint width;
+// These two only shown with the ASCII output
+bool debugsets;
+bool debugrows;
+
+// Rendered rows are collected here and written out in large blocks to output
+#define OUTPUTBLOCKSIZE (64 * 1024)
+FILE *output = stdout;
+uint64_t outputBytes;
+char *outBuffer;
+char *outPos;
+char *outEnd;
+// The most a single row can add to the buffer
+size_t rowBytes;
+
+// Glyphs for one cell, indexed by the cell bits that decide them.  ASCII top
+// line: UP, RIGHT of the cell above, RIGHT, first row.  ASCII middle line:
+// RIGHT.  ASCII bottom line and block middle line: LEFT.  Block top line: UP.
+#define TOP_UP         1
+#define TOP_ABOVERIGHT 2
+#define TOP_RIGHT      4
+#define TOP_FIRST      8
+char asciiTop[16][3];
+char asciiMiddle[2][3];
+char asciiBottom[2][3];
+char blockTop[2][2];
+char blockMiddle[2][2];
+
 /**
- * Read in paramaters and output a maze line by line.
+ * Fill in the glyph tables used by outputASCII() and outputBlock().
  */
-int main(int argc, char *argv[])
+void buildGlyphs()
 {
-    // read in paramaters
-    if (argc < 3) {
-        fprintf(stderr, "Usage: %s [width] [height] [OPTIONS]\n", argv[0]);
-        fprintf(stderr, "\ta  - ASCII style maze (default).\n");
-        fprintf(stderr, "\tb  - BLOCK style maze.\n");
-        fprintf(stderr, "\tds - Turn set debug on.\n");
-        fprintf(stderr, "\tdr - Turn row debug on.\n");
-        fprintf(stderr, "\tr  - Turn off random generation.\n");
-        return 1;
+    for (uint i = 0; i < 16; i++) {
+        bool above = i & TOP_ABOVERIGHT;
+        asciiTop[i][0] = asciiTop[i][1] = (i & TOP_UP) ? ' ' : '_';
+        if (above && !(i & TOP_RIGHT))
+            asciiTop[i][2] = ' ';
+        else
+            asciiTop[i][2] = (!(i & TOP_FIRST) && !above) ? '|' : '_';
     }
+    memcpy(asciiMiddle[0], "  |", 3);
+    memcpy(asciiMiddle[1], "   ", 3);
+    memcpy(asciiBottom[0], "|__", 3);
+    memcpy(asciiBottom[1], "___", 3);
+    memcpy(blockTop[0], "XX", 2);
+    memcpy(blockTop[1], "X ", 2);
+    memcpy(blockMiddle[0], "X ", 2);
+    memcpy(blockMiddle[1], "  ", 2);
+}
 
-    // Read in required args
-    width = atoi(argv[1]);
-    uint height = atoi(argv[2]);
+/**
+ * Allocate the output buffer, big enough to hold at least one full row
+ * (up to three lines) in either style.
+ */
+void initOutput()
+{
+    // Debug numbers are at most 10 digits wide instead of 2 spaces
+    size_t line = BUFFER + 2 + (size_t)width * (debugsets || debugrows ? 11 : 3);
+    rowBytes = 3 * line;
+    size_t size = rowBytes;
+    if (size < OUTPUTBLOCKSIZE)
+        size = OUTPUTBLOCKSIZE;
+    outBuffer = new char[size];
+    outPos = outBuffer;
+    outEnd = outBuffer + size;
+    buildGlyphs();
+}
 
-    // Check to make sure they are valid
-    if (width == 0 || height == 0) {
-        fprintf(stderr, "Maze width and height must be greater then 0.\n");
-        return 1;
-    }
+/**
+ * Write out everything that has been rendered so far.
+ */
+void flushOutput()
+{
+    fwrite(outBuffer, 1, outPos - outBuffer, output);
+    outputBytes += outPos - outBuffer;
+    outPos = outBuffer;
+}
 
-    MAZETYPE type = ASCII;
-    debugsets = false;
-    srand(time(NULL));
+/**
+ * Make sure there is room in the output buffer for size more bytes.
+ */
+inline void reserveOutput(size_t size)
+{
+    if ((size_t)(outEnd - outPos) < size)
+        flushOutput();
+}
 
-    // Read in optional args
-    for (int i = 2; i < argc; i++) {
-        if (0 == strcmp(argv[i], "ds"))
-            debugsets = true;
+/**
+ * Put n at p right aligned to (at least) two columns, same as
+ * printf("%*d", 2, n)
+ * @return where the number ends
+ */
+inline char *putNumber(char *p, uint n)
+{
+    char digits[10];
+    int count = 0;
+    do {
+        digits[count++] = '0' + n % 10;
+        n /= 10;
+    } while (n > 0);
+    if (count < 2)
+        *p++ = ' ';
+    while (count > 0)
+        *p++ = digits[--count];
+    return p;
+}
 
-        if (0 == strcmp(argv[i], "dr"))
-            debugrows = true;
+/**
+ * Draw a row for a maze that is block based with sharing colums.
+ * 
+ * This output style is here because it is very easy to output compared to ascii
+ * and because the output takes up less room (for very large mazes). 
+ * 
+ * XXXXXXXXXXXXXXXXX
+ * X               X
+ * X XXX XXX XXXXX X
+ * X   X X X X     X
+ * XXX X X X X XXX X
+ * X   X   X X   X X
+ * XXXXXXXXXXXXXXXXX
+ *
+ *  @param p where to draw the row.
+ *  @param row the cells of the row.
+ *  @param isLast if this row is the last one.
+ *  @return where the row ends
+ */
+char *renderBlock(char *p, const cell *row, bool isLast)
+{
+    // Top line
+    for (uint i = 0; i < width; i++) {
+        const char *g = blockTop[(row[i] & UP) ? 1 : 0];
+        *p++ = g[0];
+        *p++ = g[1];
+    }
+    *p++ = 'X';
+    *p++ = '\n';
 
-        // "Turn off" randomness
-        if (0 == strcmp(argv[i], "r"))
-            srand(1);
+    // Middle line
+    for (uint i = 0; i < width; i++) {
+        const char *g = blockMiddle[(row[i] & LEFT) ? 1 : 0];
+        *p++ = g[0];
+        *p++ = g[1];
+    }
+    *p++ = 'X';
+    *p++ = '\n';
 
-        if (0 == strcmp(argv[i], "a"))
-            type = ASCII;
+    // Bottom line
+    if (isLast) {
+        memset(p, 'X', 2 * width + 1);
+        p += 2 * width + 1;
+        *p++ = '\n';
+    }
+    return p;
+}
 
-        if (0 == strcmp(argv[i], "b"))
-            type = BLOCK;
+/**
+ * Draw a row for a maze that is ascii based with sharing colums.
+ * Place a buffer of size BUFFER to the left of the maze.
+ *     ________________________
+ *    |                       |
+ *    |  ___    __    ______  |
+ *    |     |  |  |  |        |
+ *    |___  |  |  |  |  ___   |
+ *    |     |     |  |     |  |
+ *    |_____|_____|__|_____|__|
+ *
+ * More complicated than renderBlock because it the top row char
+ * will change depending on the cell in the previous row.
+ *
+ *  @param p where to draw the row.
+ *  @param row the cells of the row.
+ *  @param set the set numbers of the row (only used for debugging).
+ *  @param isLast if this row is the last one.
+ *  @param isFirst if this row is the first one.
+ *  @return where the row ends
+ */
+char *renderASCII(char *p, const cell *row, const uint *set, bool isLast,
+                  bool isFirst)
+{
+    // Top line
+    memset(p, ' ', BUFFER);
+    p += BUFFER;
+    *p++ = isFirst ? ' ' : '|';
+    uint first = isFirst ? TOP_FIRST : 0;
+    for (uint r = 0; r < width; r++) {
+        uint i = first;
+        if (row[r] & UP)
+            i |= TOP_UP;
+        if (row[r] & ABOVERIGHT)
+            i |= TOP_ABOVERIGHT;
+        if (row[r] & RIGHT)
+            i |= TOP_RIGHT;
+        const char *g = asciiTop[i];
+        *p++ = g[0];
+        *p++ = g[1];
+        *p++ = g[2];
     }
+    *p++ = '\n';
 
-    // Create/init vars
-    set = new uint[width];
-    row = new uint[width];
-    previousRow = new uint[width];
-    for (uint i = 0; i < width; i++) {
-        set[i] = i + width + 1;
-        row[i] = 0;
-        previousRow[i] = 0;
+    // Middle line
+    memset(p, ' ', BUFFER);
+    p += BUFFER;
+    *p++ = '|';
+    if (debugsets || debugrows) {
+        for (uint r = 0; r < width; r++) {
+            p = putNumber(p, debugsets ? set[r] : row[r] & ~ABOVERIGHT);
+            *p++ = (row[r] & RIGHT) ? ' ' : '|';
+        }
+    } else {
+        for (uint r = 0; r < width; r++) {
+            const char *g = asciiMiddle[(row[r] & RIGHT) ? 1 : 0];
+            *p++ = g[0];
+            *p++ = g[1];
+            *p++ = g[2];
+        }
     }
+    *p++ = '\n';
 
-    // create & print out the rows
-    bool isLast, isFirst;
-    for (uint i = 0; i < height; i++) {
-        isLast = (i == height - 1);
-        isFirst = (i == 0);
-        makeRow(isLast);
-        if (type == ASCII)
-            outputASCII(isLast, isFirst);
-        else if (type == BLOCK)
-            outputBlock(isLast);
+    // If this is the last row in the maze then fill in the bottom line.
+    if (isLast) {
+        memset(p, ' ', BUFFER);
+        p += BUFFER;
+        for (uint r = 0; r < width; r++) {
+            const char *g = asciiBottom[(row[r] & LEFT) ? 1 : 0];
+            *p++ = g[0];
+            *p++ = g[1];
+            *p++ = g[2];
+        }
+        *p++ = '|';
+        *p++ = '\n';
     }
+    return p;
+}
 
-    // Memory cleanup;
-    delete[]set;
-    delete[]row;
-    delete[]previousRow;
+/**
+ * Draw a row of the maze in the packed format, only the RIGHT and DOWN
+ * bits of each cell are kept.
+ *
+ *  @param p where to draw the row.
+ *  @param row the cells of the row.
+ *  @return where the row ends
+ */
+char *renderPacked(char *p, const cell *row)
+{
+    unsigned char *packed = (unsigned char *)p;
+    size_t size = mazeFileRowBytes(width);
+    memset(packed, 0, size);
+    for (uint i = 0; i < width; i++) {
+        uint bits = 0;
+        if (row[i] & RIGHT)
+            bits |= MAZEFILE_RIGHT;
+        if (row[i] & DOWN)
+            bits |= MAZEFILE_DOWN;
+        packed[i / 4] |= bits << ((i % 4) * 2);
+    }
+    return p + size;
+}
+
+/**
+ * Draw a row in the style type at p.
+ * @return where the row ends
+ */
+inline char *renderRow(MAZETYPE type, char *p, const cell *row, const uint *set,
+                       bool isLast, bool isFirst)
+{
+    if (type == ASCII)
+        return renderASCII(p, row, set, isLast, isFirst);
+    else if (type == BLOCK)
+        return renderBlock(p, row, isLast);
+    return renderPacked(p, row);
+}
+
+// Packed output state, see mazefile.h
+MazeFileHeader packedHeader;
+off_t packedHeaderOffset;
+
+/**
+ * Start a packed maze of width by height.  If the output can be seeked the
+ * checksum is filled into the header at the end, otherwise (or if it is
+ * opened for appending, where pwrite() would go to the end) it is put in a
+ * trailer.
+ */
+void beginPacked(uint height)
+{
+    mazeFileInitHeader(&packedHeader, width, height);
+    packedHeaderOffset = lseek(fileno(output), 0, SEEK_CUR);
+    int flags = fcntl(fileno(output), F_GETFL);
+    if (packedHeaderOffset == -1 || flags == -1 || (flags & O_APPEND))
+        packedHeader.flags |= MAZEFILE_TRAILER;
 
-    return 0;
+    reserveOutput(MAZEFILE_HEADERSIZE);
+    mazeFileWriteHeader((unsigned char *)outPos, &packedHeader);
+    outPos += MAZEFILE_HEADERSIZE;
+    packedHeader.checksum = MAZEFILE_CHECKSUM_INIT;
 }
 
+/**
+ * Finish off a packed maze with its checksum.
+ */
+void endPacked()
+{
+    unsigned char sum[4];
+    mazeFilePut32(sum, packedHeader.checksum);
+    if (packedHeader.flags & MAZEFILE_TRAILER) {
+        reserveOutput(4);
+        memcpy(outPos, sum, 4);
+        outPos += 4;
+        flushOutput();
+        return;
+    }
+    flushOutput();
+    fflush(output);
+    if (pwrite(fileno(output), sum, 4, packedHeaderOffset + 36) != 4)
+        fprintf(stderr, "Unable to write the packed maze checksum.\n");
+}
+
+/**
+ * Draw a row in the style type and add it to the output.
+ */
+inline void outputRow(MAZETYPE type, const cell *row, const uint *set,
+                      bool isLast, bool isFirst)
+{
+    reserveOutput(rowBytes);
+    char *end = renderRow(type, outPos, row, set, isLast, isFirst);
+    if (type == PACKED)
+        packedHeader.checksum = mazeFileChecksum(packedHeader.checksum,
+                                                 (unsigned char *)outPos,
+                                                 end - outPos);
+    outPos = end;
+}
+
+/**
+ * Direct to file output (-o)
+ *
+ * Every line of an ASCII or BLOCK maze is the same length and a packed row is
+ * always the same size, so the size of the whole file and where each row goes
+ * in it are known before any row is made.  The file is set to its final size
+ * and mapped into memory.  The rows are handed off in batches to render
+ * threads which draw them straight into their place in the file while the
+ * generator goes on making more rows.
+ */
+
+struct Band;
+void releaseBand(Band *band);
+
+struct RenderJob {
+    cell *rows;
+    // Maze row number of the first row and how many rows
+    uint first;
+    uint count;
+    // Band the rows belong to or NULL if they are a batch
+    Band *band;
+};
+
+// Rows put in one batch by the single thread generator
+#define BATCHBYTES (1024 * 1024)
+
+char *fileMap;
+size_t fileSize;
+int fileDescriptor;
+MAZETYPE fileType;
+uint fileHeight;
+
+pthread_mutex_t renderLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t renderCond = PTHREAD_COND_INITIALIZER;
+pthread_t *renderThreads;
+uint renderThreadCount;
+// Ring of jobs waiting to be drawn
+RenderJob *renderQueue;
+uint queueCapacity;
+uint queueHead;
+uint queueLength;
+bool renderFinished;
+// Batches that aren't being filled or drawn
+cell **freeBatches;
+uint freeBatchCount;
+uint batchCount;
+uint batchRows;
+
+/**
+ * @return the length of one line of the maze in style type
+ */
+size_t lineLength(MAZETYPE type)
+{
+    if (type == ASCII)
+        return BUFFER + 2 + 3 * (size_t)width;
+    return 2 * (size_t)width + 2;
+}
+
+/**
+ * @return where row r of a maze in style type starts in the file
+ */
+size_t rowOffset(MAZETYPE type, uint r)
+{
+    if (type == PACKED)
+        return MAZEFILE_HEADERSIZE + r * mazeFileRowBytes(width);
+    return 2 * r * lineLength(type);
+}
+
+/**
+ * Create fileName the exact size of the maze and map it in.
+ * @param existing if the file was already made by an earlier run that is
+ *                 being resumed
+ * @return false if the file couldn't be made
+ */
+bool openFile(const char *fileName, MAZETYPE type, uint height, bool existing)
+{
+    fileType = type;
+    fileHeight = height;
+    if (type == PACKED)
+        fileSize = rowOffset(type, height);
+    else
+        fileSize = (2 * (size_t)height + 1) * lineLength(type);
+
+    fileDescriptor = open(fileName, existing ? O_RDWR : O_RDWR | O_CREAT | O_TRUNC,
+                          0644);
+    if (fileDescriptor == -1) {
+        perror(fileName);
+        return false;
+    }
+    if (existing && lseek(fileDescriptor, 0, SEEK_END) != (off_t)fileSize) {
+        fprintf(stderr, "%s: Not the maze being resumed.\n", fileName);
+        close(fileDescriptor);
+        return false;
+    }
+    if (ftruncate(fileDescriptor, fileSize) != 0) {
+        perror(fileName);
+        close(fileDescriptor);
+        return false;
+    }
+    // Reserve the disk space now rather than failing part way through
+    int error = posix_fallocate(fileDescriptor, 0, fileSize);
+    if (error == ENOSPC) {
+        fprintf(stderr, "%s: Not enough space for the maze.\n", fileName);
+        close(fileDescriptor);
+        return false;
+    }
+    fileMap = (char *)mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                           fileDescriptor, 0);
+    if (fileMap == MAP_FAILED) {
+        perror(fileName);
+        fileMap = NULL;
+        close(fileDescriptor);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Thread that draws rows into the file until there are no more jobs.
+ */
+void *renderThread(void *)
+{
+    for (;;) {
+        pthread_mutex_lock(&renderLock);
+        while (queueLength == 0 && !renderFinished)
+            pthread_cond_wait(&renderCond, &renderLock);
+        if (queueLength == 0) {
+            pthread_mutex_unlock(&renderLock);
+            break;
+        }
+        RenderJob job = renderQueue[queueHead];
+        queueHead = (queueHead + 1) % queueCapacity;
+        queueLength--;
+        pthread_cond_broadcast(&renderCond);
+        pthread_mutex_unlock(&renderLock);
+
+        for (uint i = 0; i < job.count; i++) {
+            uint r = job.first + i;
+            renderRow(fileType, fileMap + rowOffset(fileType, r),
+                      job.rows + (size_t)i * width, NULL,
+                      r == fileHeight - 1, r == 0);
+        }
+
+        if (job.band) {
+            releaseBand(job.band);
+        } else {
+            pthread_mutex_lock(&renderLock);
+            freeBatches[freeBatchCount++] = job.rows;
+            pthread_cond_broadcast(&renderCond);
+            pthread_mutex_unlock(&renderLock);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Start threadCount render threads.
+ */
+void startRenderThreads(uint threadCount)
+{
+    renderThreadCount = threadCount;
+    queueCapacity = 2 * threadCount + 2;
+    renderQueue = new RenderJob[queueCapacity];
+    queueHead = 0;
+    queueLength = 0;
+    renderFinished = false;
+
+    // One batch for each thread to draw, one being filled and one spare
+    batchRows = BATCHBYTES / width;
+    if (batchRows == 0)
+        batchRows = 1;
+    batchCount = threadCount + 2;
+    freeBatches = new cell *[batchCount];
+    for (uint i = 0; i < batchCount; i++)
+        freeBatches[i] = new cell[(size_t)batchRows * width];
+    freeBatchCount = batchCount;
+
+    renderThreads = new pthread_t[threadCount];
+    for (uint t = 0; t < threadCount; t++)
+        pthread_create(&renderThreads[t], NULL, renderThread, NULL);
+}
+
+/**
+ * Queue count rows starting with maze row first to be drawn.
+ */
+void submitRows(cell *rows, uint first, uint count, Band *band)
+{
+    pthread_mutex_lock(&renderLock);
+    while (queueLength == queueCapacity)
+        pthread_cond_wait(&renderCond, &renderLock);
+    RenderJob *job = &renderQueue[(queueHead + queueLength) % queueCapacity];
+    job->rows = rows;
+    job->first = first;
+    job->count = count;
+    job->band = band;
+    queueLength++;
+    pthread_cond_broadcast(&renderCond);
+    pthread_mutex_unlock(&renderLock);
+}
+
+/**
+ * @return an empty batch to fill with batchRows rows
+ */
+cell *takeBatch()
+{
+    pthread_mutex_lock(&renderLock);
+    while (freeBatchCount == 0)
+        pthread_cond_wait(&renderCond, &renderLock);
+    cell *batch = freeBatches[--freeBatchCount];
+    pthread_mutex_unlock(&renderLock);
+    return batch;
+}
+
+/**
+ * Wait for every row handed out so far to be drawn.
+ */
+void waitForRender()
+{
+    pthread_mutex_lock(&renderLock);
+    while (queueLength > 0 || freeBatchCount < batchCount)
+        pthread_cond_wait(&renderCond, &renderLock);
+    pthread_mutex_unlock(&renderLock);
+}
+
+/**
+ * Wait for all of the rows to be drawn and close the file.
+ * @return false if the file couldn't be written
+ */
+bool finishFile()
+{
+    pthread_mutex_lock(&renderLock);
+    renderFinished = true;
+    pthread_cond_broadcast(&renderCond);
+    pthread_mutex_unlock(&renderLock);
+    for (uint t = 0; t < renderThreadCount; t++)
+        pthread_join(renderThreads[t], NULL);
+
+    if (fileType == PACKED) {
+        MazeFileHeader header;
+        mazeFileInitHeader(&header, width, fileHeight);
+        header.checksum = mazeFileChecksum(MAZEFILE_CHECKSUM_INIT,
+                                           (unsigned char *)fileMap + MAZEFILE_HEADERSIZE,
+                                           fileSize - MAZEFILE_HEADERSIZE);
+        mazeFileWriteHeader((unsigned char *)fileMap, &header);
+    }
+
+    bool ok = munmap(fileMap, fileSize) == 0;
+    ok = (close(fileDescriptor) == 0) && ok;
+    if (!ok)
+        perror("Unable to write the maze");
+
+    for (uint i = 0; i < batchCount; i++)
+        delete[]freeBatches[i];
+    delete[]freeBatches;
+    delete[]renderQueue;
+    delete[]renderThreads;
+    return ok;
+}
+
+/**
+ * Checkpoints
+ *
+ * All Eller's algorithm needs to carry on is the set numbers and cells of the
+ * last row made plus the state of the random number generator.  Saving that
+ * every so many rows lets an interrupted maze be finished (--resume) and lets
+ * any range of rows of a big maze be made again (--rows) without starting
+ * from the first row.
+ *
+ * The checkpoint file is a header followed by one fixed size record for
+ * every N rows, all numbers little endian:
+ *
+ * header:  "AMZC", version, width, height, N, seed (64 bit), reserved
+ * record:  rows made, random bits left, random state (4 x 64 bit),
+ *          random bits (64 bit), set numbers (32 bit each), cells (a byte each)
+ *
+ * Record i is written once rows (i + 1) * N have been made and written out.
+ */
+
+#define CHECKPOINT_MAGIC "AMZC"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_HEADERSIZE 32
+#define CHECKPOINT_RECORDHEADER 48
+
+FILE *checkpointFile;
+uint checkpointEvery;
+uint checkpointCount;
+
+inline void put64(unsigned char *p, uint64_t v)
+{
+    mazeFilePut32(p, v);
+    mazeFilePut32(p + 4, v >> 32);
+}
+
+inline uint64_t get64(const unsigned char *p)
+{
+    return mazeFileGet32(p) | ((uint64_t)mazeFileGet32(p + 4) << 32);
+}
+
+/**
+ * @return the size of one checkpoint record
+ */
+size_t checkpointRecordSize()
+{
+    return CHECKPOINT_RECORDHEADER + 5 * (size_t)width;
+}
+
+/**
+ * Start a new checkpoint file fileName for a maze of height rows made
+ * from seed with a checkpoint every rows.
+ * @return false if the file couldn't be made
+ */
+bool createCheckpoints(const char *fileName, uint height, uint every, uint64_t seed)
+{
+    checkpointFile = fopen(fileName, "w+b");
+    if (!checkpointFile) {
+        perror(fileName);
+        return false;
+    }
+    unsigned char header[CHECKPOINT_HEADERSIZE];
+    memset(header, 0, CHECKPOINT_HEADERSIZE);
+    memcpy(header, CHECKPOINT_MAGIC, 4);
+    mazeFilePut32(header + 4, CHECKPOINT_VERSION);
+    mazeFilePut32(header + 8, width);
+    mazeFilePut32(header + 12, height);
+    mazeFilePut32(header + 16, every);
+    put64(header + 20, seed);
+    checkpointEvery = every;
+    checkpointCount = 0;
+    if (fwrite(header, 1, CHECKPOINT_HEADERSIZE, checkpointFile) != CHECKPOINT_HEADERSIZE
+        || fflush(checkpointFile) != 0) {
+        perror(fileName);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Open the existing checkpoint file fileName for a maze of height rows and
+ * read back the seed it was made with.
+ * @return false if the file can't be used for this maze
+ */
+bool openCheckpoints(const char *fileName, uint height, uint64_t *seed)
+{
+    checkpointFile = fopen(fileName, "r+b");
+    if (!checkpointFile) {
+        perror(fileName);
+        return false;
+    }
+    unsigned char header[CHECKPOINT_HEADERSIZE];
+    if (fread(header, 1, CHECKPOINT_HEADERSIZE, checkpointFile) != CHECKPOINT_HEADERSIZE
+        || 0 != memcmp(header, CHECKPOINT_MAGIC, 4)
+        || mazeFileGet32(header + 4) != CHECKPOINT_VERSION) {
+        fprintf(stderr, "%s: Not a checkpoint file.\n", fileName);
+        return false;
+    }
+    if (mazeFileGet32(header + 8) != width || mazeFileGet32(header + 12) != height) {
+        fprintf(stderr, "%s: Checkpoints are for a %u x %u maze.\n", fileName,
+                mazeFileGet32(header + 8), mazeFileGet32(header + 12));
+        return false;
+    }
+    checkpointEvery = mazeFileGet32(header + 16);
+    *seed = get64(header + 20);
+
+    // A record cut short by an interruption is ignored (and overwritten)
+    fseeko(checkpointFile, 0, SEEK_END);
+    off_t size = ftello(checkpointFile);
+    checkpointCount = (size - CHECKPOINT_HEADERSIZE) / checkpointRecordSize();
+    if (checkpointEvery == 0)
+        checkpointCount = 0;
+    return true;
+}
+
+/**
+ * Save the state of e as the next checkpoint.
+ * @return false if it couldn't be written
+ */
+bool writeCheckpoint(Eller *e)
+{
+    size_t size = checkpointRecordSize();
+    unsigned char *record = new unsigned char[size];
+    mazeFilePut32(record, e->rowCount);
+    mazeFilePut32(record + 4, e->rng.bitsLeft);
+    for (int i = 0; i < 4; i++)
+        put64(record + 8 + 8 * i, e->rng.s[i]);
+    put64(record + 40, e->rng.bits);
+    unsigned char *p = record + CHECKPOINT_RECORDHEADER;
+    for (uint i = 0; i < width; i++, p += 4)
+        mazeFilePut32(p, e->set[i]);
+    memcpy(p, e->row, width);
+
+    fseeko(checkpointFile, CHECKPOINT_HEADERSIZE + (off_t)checkpointCount * size,
+           SEEK_SET);
+    bool ok = fwrite(record, 1, size, checkpointFile) == size
+              && fflush(checkpointFile) == 0;
+    if (ok)
+        checkpointCount++;
+    else
+        perror("Unable to write checkpoint");
+    delete[]record;
+    return ok;
+}
+
+/**
+ * Load the last checkpoint at or before row into e (which must already be
+ * seeded for the case that there is none).
+ * @return the number of rows e has made
+ */
+uint loadCheckpoint(Eller *e, uint row)
+{
+    uint index = checkpointEvery ? row / checkpointEvery : 0;
+    if (index > checkpointCount)
+        index = checkpointCount;
+    if (index == 0)
+        return 0;
+
+    size_t size = checkpointRecordSize();
+    unsigned char *record = new unsigned char[size];
+    fseeko(checkpointFile, CHECKPOINT_HEADERSIZE + (off_t)(index - 1) * size,
+           SEEK_SET);
+    if (fread(record, 1, size, checkpointFile) != size
+        || mazeFileGet32(record) != index * checkpointEvery) {
+        fprintf(stderr, "Checkpoint %u is damaged, starting over.\n", index);
+        delete[]record;
+        return 0;
+    }
+    e->rowCount = mazeFileGet32(record);
+    e->rng.bitsLeft = mazeFileGet32(record + 4);
+    for (int i = 0; i < 4; i++)
+        e->rng.s[i] = get64(record + 8 + 8 * i);
+    e->rng.bits = get64(record + 40);
+    const unsigned char *p = record + CHECKPOINT_RECORDHEADER;
+    for (uint i = 0; i < width; i++, p += 4) {
+        e->set[i] = mazeFileGet32(p);
+        if (e->set[i] >= 2 * width + 2) {
+            fprintf(stderr, "Checkpoint %u is damaged, starting over.\n", index);
+            delete[]record;
+            e->reset();
+            return 0;
+        }
+    }
+    memcpy(e->row, p, width);
+    e->recount();
+    delete[]record;
+
+    // Checkpoints after this one would be for rows that are made again
+    checkpointCount = index;
+    return e->rowCount;
+}
+
+/**
+ * Band generation
+ *
+ * Eller's algorithm has to make the rows in order so on its own it can only
+ * use one core.  To use more the maze is cut into bands of rows that are each
+ * made by their own thread as if they were small mazes, except that a band's
+ * last row is left unclosed and nothing goes down from it.
+ *
+ * Every set Eller's algorithm makes reaches the last row of its band, so a
+ * band is a forest whose trees all touch the band's last row.  The bands are
+ * then joined in order across each seam, treating the connected pieces on
+ * both sides as one disjoint-set forest:
+ *
+ * 1) Randomly open seam cells that join two different pieces.
+ * 2) Open every remaining seam cell that still joins two different pieces.
+ *    Afterwards every piece above the seam reaches the band below.
+ * 3) After the last seam, close the last row of the maze like Eller's
+ *    algorithm does, using the joined pieces.
+ *
+ * Each opening joins two pieces that were not connected and everything ends
+ * up in one piece so the result is still a perfect maze.  A band can be
+ * written out as soon as the seam below it is joined.
+ *
+ * Pieces of a band are numbered 0 to 3 * width + 1: pieces touching the first
+ * row are numbered by a first row cell, the rest by width + their set number.
+ */
+
+// Rows in each band
+#define BANDHEIGHT 64
+
+struct Band {
+    cell *rows;
+    uint height;
+    // Piece of each cell in the band's first and last row
+    uint *topId;
+    uint *bottomId;
+    bool done;
+};
+
+Band *bands;
+uint bandCount;
+uint bandHeight;
+uint64_t bandSeed;
+uint height;
+
+// Work handed out to the band threads
+pthread_mutex_t bandLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t bandCond = PTHREAD_COND_INITIALIZER;
+uint nextBand;
+uint bandsWritten;
+// How far ahead of the output the threads may get
+uint bandWindow;
+
+// Joining state, pieces of the band above a seam are [0, pieceCount) and the
+// ones below are [pieceCount, 2 * pieceCount)
+uint pieceCount;
+uint *pieceParent;
+uint *seamParent;
+uint *seamFirst;
+Random seamRng;
+
+inline uint findPiece(uint *p, uint c)
+{
+    while (p[c] != c) {
+        p[c] = p[p[c]];
+        c = p[c];
+    }
+    return c;
+}
+
+/**
+ * Make band b with the row state e.
+ */
+void makeBand(Eller *e, uint b)
+{
+    Band *band = &bands[b];
+    e->reset();
+    e->rng.seed(bandSeed ^ (0x9e3779b97f4a7c15ULL * (b + 1)));
+    for (uint i = 0; i < band->height; i++) {
+        e->makeRow(i == band->height - 1);
+        memcpy(band->rows + (size_t)i * width, e->row, width);
+    }
+
+    for (uint c = 0; c < width; c++) {
+        band->topId[c] = e->findTop(c);
+        uint a = e->anchor[e->set[c]];
+        band->bottomId[c] = (a == NOSET) ? width + e->set[c] : e->findTop(a);
+    }
+}
+
+/**
+ * Sidewinder and Binary-Tree
+ *
+ * Both of these carve each row without looking at any other row so every
+ * row can be made on its own (each row has its own random numbers seeded
+ * from the row number).  There are no seams to join and the maze doesn't
+ * depend on how it is split between threads.  The texture is strongly
+ * biased, but they are as fast as it gets.
+ *
+ * They are the usual algorithms turned upside down so that they carve DOWN
+ * (which the row itself owns) instead of UP:
+ *
+ * Binary-Tree: every cell opens either RIGHT or DOWN.  The last row can only
+ * go RIGHT and the last column can only go DOWN.
+ *
+ * Sidewinder: the last row is one long passage.  In the other rows cells are
+ * randomly joined to the RIGHT into runs and every run opens DOWN from one
+ * random cell in it.
+ *
+ * Every cell but the bottom right one has exactly one passage that leads
+ * closer to the bottom right so the maze is perfect.
+ */
+
+ALGORITHM algorithm = ELLER;
+
+/**
+ * Carve row y, only setting its RIGHT and DOWN bits.
+ */
+void carveRow(uint y, cell *row)
+{
+    Random rng;
+    rng.seed(bandSeed ^ (0x9e3779b97f4a7c15ULL * (y + 1)));
+    memset(row, EMPTY, width);
+
+    if (y == height - 1) {
+        for (uint x = 0; x < width - 1; x++)
+            row[x] = RIGHT;
+        return;
+    }
+
+    if (algorithm == BINARYTREE) {
+        for (uint x = 0; x < width; x++)
+            row[x] = (x == width - 1 || rng.flip()) ? DOWN : RIGHT;
+        return;
+    }
+
+    uint runStart = 0;
+    for (uint x = 0; x < width; x++) {
+        if (x < width - 1 && rng.flip()) {
+            row[x] = RIGHT;
+            continue;
+        }
+        row[runStart + rng.next() % (x - runStart + 1)] |= DOWN;
+        runStart = x + 1;
+    }
+}
+
+/**
+ * Fill in the UP, LEFT and ABOVERIGHT bits of a carved row from itself and
+ * the carved row above it (or NULL for the first row).
+ */
+void finishRow(cell *row, const cell *above)
+{
+    for (uint x = 0; x < width; x++) {
+        cell c = row[x];
+        if (above && (above[x] & DOWN))
+            c |= UP;
+        if (above && (above[x] & RIGHT))
+            c |= ABOVERIGHT;
+        if (x > 0 && (row[x - 1] & RIGHT))
+            c |= LEFT;
+        row[x] = c;
+    }
+}
+
+/**
+ * Make band b with Sidewinder or Binary-Tree, scratch is room for a row.
+ */
+void carveBand(uint b, cell *scratch)
+{
+    Band *band = &bands[b];
+    uint y = b * bandHeight;
+    const cell *above = NULL;
+    if (y > 0) {
+        carveRow(y - 1, scratch);
+        above = scratch;
+    }
+    for (uint i = 0; i < band->height; i++) {
+        cell *row = band->rows + (size_t)i * width;
+        carveRow(y + i, row);
+        finishRow(row, above);
+        above = row;
+    }
+}
+
+/**
+ * Thread that makes bands until there are none left.
+ */
+void *bandThread(void *)
+{
+    Eller e;
+    e.init(width, true);
+    e.closeLastRow = false;
+    cell *scratch = new cell[width];
+
+    for (;;) {
+        pthread_mutex_lock(&bandLock);
+        while (nextBand < bandCount && nextBand >= bandsWritten + bandWindow)
+            pthread_cond_wait(&bandCond, &bandLock);
+        if (nextBand >= bandCount) {
+            pthread_mutex_unlock(&bandLock);
+            break;
+        }
+        uint b = nextBand++;
+        Band *band = &bands[b];
+        band->rows = new cell[(size_t)band->height * width];
+        band->topId = new uint[width];
+        band->bottomId = new uint[width];
+        pthread_mutex_unlock(&bandLock);
+
+        if (algorithm == ELLER)
+            makeBand(&e, b);
+        else
+            carveBand(b, scratch);
+
+        pthread_mutex_lock(&bandLock);
+        band->done = true;
+        pthread_cond_broadcast(&bandCond);
+        pthread_mutex_unlock(&bandLock);
+    }
+
+    e.cleanup();
+    delete[]scratch;
+    return NULL;
+}
+
+/**
+ * Wait for band b to be made.
+ */
+void waitForBand(uint b)
+{
+    pthread_mutex_lock(&bandLock);
+    while (!bands[b].done)
+        pthread_cond_wait(&bandCond, &bandLock);
+    pthread_mutex_unlock(&bandLock);
+}
+
+/**
+ * Open the seam between band b and band b + 1 and work out which pieces of
+ * band b + 1 are now connected.
+ */
+void joinSeam(uint b)
+{
+    cell *above = bands[b].rows + (size_t)(bands[b].height - 1) * width;
+    cell *below = bands[b + 1].rows;
+    uint *bottomId = bands[b].bottomId;
+    uint *topId = bands[b + 1].topId;
+
+    for (uint i = 0; i < pieceCount; i++) {
+        seamParent[i] = findPiece(pieceParent, i);
+        seamParent[pieceCount + i] = pieceCount + i;
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint c = 0; c < width; c++) {
+            if (pass == 0 && !seamRng.flip())
+                continue;
+            uint a = findPiece(seamParent, bottomId[c]);
+            uint d = findPiece(seamParent, pieceCount + topId[c]);
+            if (a == d)
+                continue;
+            above[c] |= DOWN;
+            below[c] |= UP;
+            seamParent[a] = d;
+        }
+    }
+    for (uint c = 0; c < width; c++) {
+        if (above[c] & RIGHT)
+            below[c] |= ABOVERIGHT;
+    }
+
+    // Pieces of band b + 1 that are connected share a representative
+    for (uint i = 0; i < 2 * pieceCount; i++)
+        seamFirst[i] = NOSET;
+    for (uint i = 0; i < pieceCount; i++) {
+        uint root = findPiece(seamParent, pieceCount + i);
+        if (seamFirst[root] == NOSET)
+            seamFirst[root] = i;
+        pieceParent[i] = seamFirst[root];
+    }
+}
+
+/**
+ * Join all of the sets that are left in the last row of the maze.
+ */
+void closeLastBand()
+{
+    Band *band = &bands[bandCount - 1];
+    cell *last = band->rows + (size_t)(band->height - 1) * width;
+    for (uint r = 0; r < width - 1; r++) {
+        uint a = findPiece(pieceParent, band->bottomId[r]);
+        uint b = findPiece(pieceParent, band->bottomId[r + 1]);
+        if (a == b)
+            continue;
+        last[r] |= RIGHT;
+        last[r + 1] |= LEFT;
+        pieceParent[a] = b;
+    }
+}
+
+/**
+ * Free a band that has been written out and let the threads make more.
+ */
+void releaseBand(Band *band)
+{
+    pthread_mutex_lock(&bandLock);
+    delete[]band->rows;
+    delete[]band->topId;
+    delete[]band->bottomId;
+    bandsWritten++;
+    pthread_cond_broadcast(&bandCond);
+    pthread_mutex_unlock(&bandLock);
+}
+
+/**
+ * Make and print out the maze in bands using threadCount threads.  Eller's
+ * algorithm bands are joined at the seams, the others need nothing more.
+ */
+void generateBands(MAZETYPE type, uint threadCount, uint64_t seed)
+{
+    bandHeight = BANDHEIGHT;
+    bandCount = (height + bandHeight - 1) / bandHeight;
+    bandSeed = seed;
+    bandWindow = 2 * threadCount;
+    nextBand = 0;
+    bandsWritten = 0;
+    bands = new Band[bandCount];
+    for (uint b = 0; b < bandCount; b++) {
+        bands[b].height = (b == bandCount - 1) ? height - b * bandHeight
+                                               : bandHeight;
+        bands[b].done = false;
+    }
+
+    pieceCount = 3 * width + 2;
+    pieceParent = new uint[pieceCount];
+    seamParent = new uint[2 * pieceCount];
+    seamFirst = new uint[2 * pieceCount];
+    for (uint i = 0; i < pieceCount; i++)
+        pieceParent[i] = i;
+    seamRng.seed(seed);
+
+    pthread_t *threads = new pthread_t[threadCount];
+    for (uint t = 0; t < threadCount; t++)
+        pthread_create(&threads[t], NULL, bandThread, NULL);
+
+    for (uint b = 0; b < bandCount; b++) {
+        waitForBand(b);
+        if (algorithm != ELLER) {
+            // Carved bands are already complete
+        } else if (b + 1 < bandCount) {
+            waitForBand(b + 1);
+            joinSeam(b);
+        } else {
+            closeLastBand();
+        }
+
+        Band *band = &bands[b];
+        if (fileMap) {
+            submitRows(band->rows, b * bandHeight, band->height, band);
+            continue;
+        }
+        for (uint i = 0; i < band->height; i++) {
+            cell *r = band->rows + (size_t)i * width;
+            bool isFirst = (b == 0 && i == 0);
+            bool isLast = (b == bandCount - 1 && i == band->height - 1);
+            outputRow(type, r, NULL, isLast, isFirst);
+        }
+        releaseBand(band);
+    }
+
+    // Bands given to the render threads are released by them
+    pthread_mutex_lock(&bandLock);
+    while (bandsWritten < bandCount)
+        pthread_cond_wait(&bandCond, &bandLock);
+    pthread_mutex_unlock(&bandLock);
+
+    for (uint t = 0; t < threadCount; t++)
+        pthread_join(threads[t], NULL);
+
+    delete[]threads;
+    delete[]bands;
+    delete[]pieceParent;
+    delete[]seamParent;
+    delete[]seamFirst;
+}
+
+/**
+ * Carry on making rows with e (which has made first rows so far) up to row
+ * to, writing out the rows from row from on.
+ *
+ * @param saving if a checkpoint should be written every checkpointEvery rows
+ */
+void generateRows(MAZETYPE type, Eller *e, uint first, uint from, uint to,
+                  bool saving)
+{
+    bool isLast, isFirst;
+    cell *batch = NULL;
+    uint batchFirst = 0;
+    for (uint i = first; i < to; i++) {
+        isLast = (i == height - 1);
+        isFirst = (i == 0);
+        e->makeRow(isLast);
+        if (i < from) {
+            // Just catching up to the rows asked for
+        } else if (!fileMap) {
+            outputRow(type, e->row, e->set, isLast, isFirst);
+        } else {
+            if (!batch) {
+                batch = takeBatch();
+                batchFirst = i;
+            }
+            memcpy(batch + (size_t)(i - batchFirst) * width, e->row, width);
+            if (isLast || i - batchFirst + 1 == batchRows) {
+                submitRows(batch, batchFirst, i - batchFirst + 1, NULL);
+                batch = NULL;
+            }
+        }
+
+        // Only save once everything before the checkpoint is written out
+        if (saving && (i + 1) % checkpointEvery == 0 && !isLast) {
+            if (fileMap) {
+                if (batch) {
+                    submitRows(batch, batchFirst, i - batchFirst + 1, NULL);
+                    batch = NULL;
+                }
+                waitForRender();
+            } else {
+                flushOutput();
+                fflush(output);
+            }
+            writeCheckpoint(e);
+        }
+    }
+}
+
+#ifndef GENMAZE_NO_MAIN
+/**
+ * Read in paramaters and output a maze line by line.
+ */
+int main(int argc, char *argv[])
+{
+    // read in paramaters
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s [width] [height] [OPTIONS]\n", argv[0]);
+        fprintf(stderr, "\ta  - ASCII style maze (default).\n");
+        fprintf(stderr, "\tb  - BLOCK style maze.\n");
+        fprintf(stderr, "\tp  - Packed binary maze (2 bits a cell).\n");
+        fprintf(stderr, "\tds - Turn set debug on.\n");
+        fprintf(stderr, "\tdr - Turn row debug on.\n");
+        fprintf(stderr, "\tr  - Turn off random generation (same as --seed 1).\n");
+        fprintf(stderr, "\t--seed N - Seed the generator with N, the same seed\n"
+                        "\t           always gives the same maze.\n");
+        fprintf(stderr, "\t--threads N - Make the maze in bands of %d rows on N\n"
+                        "\t              threads (0 for one per core).\n",
+                BANDHEIGHT);
+        fprintf(stderr, "\t-o FILE - Write the maze straight into FILE, drawing\n"
+                        "\t          the rows on one thread per core.\n");
+        fprintf(stderr, "\t--checkpoint FILE --every N - Save the generator to\n"
+                        "\t          FILE every N rows.\n");
+        fprintf(stderr, "\t--checkpoint FILE --resume -o MAZE - Finish making\n"
+                        "\t          MAZE from its last checkpoint.\n");
+        fprintf(stderr, "\t--rows A B - Only write out rows A up to B, started\n"
+                        "\t          from the closest --checkpoint FILE if given.\n");
+        fprintf(stderr, "\t--algo eller|sidewinder|binary - How to carve the maze.\n"
+                        "\t          Sidewinder and Binary-Tree are much faster and\n"
+                        "\t          use every core but have a strong bias.\n");
+        return 1;
+    }
+
+    // Read in required args
+    width = atoi(argv[1]);
+    height = atoi(argv[2]);
+
+    // Check to make sure they are valid
+    if (width == 0 || height == 0) {
+        fprintf(stderr, "Maze width and height must be greater then 0.\n");
+        return 1;
+    }
+
+    MAZETYPE type = ASCII;
+    debugsets = false;
+    uint64_t seed = time(NULL);
+    int threadCount = -1;
+    const char *outputFile = NULL;
+    const char *checkpointName = NULL;
+    uint every = 0;
+    bool resume = false;
+    bool someRows = false;
+    uint rowsFrom = 0;
+    uint rowsTo = height;
+
+    // Read in optional args
+    for (int i = 2; i < argc; i++) {
+        if (0 == strcmp(argv[i], "ds"))
+            debugsets = true;
+
+        if (0 == strcmp(argv[i], "dr"))
+            debugrows = true;
+
+        // "Turn off" randomness
+        if (0 == strcmp(argv[i], "r"))
+            seed = 1;
+
+        if (0 == strcmp(argv[i], "--seed")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "--seed needs a number.\n");
+                return 1;
+            }
+            seed = strtoull(argv[++i], NULL, 0);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--threads")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "--threads needs a number.\n");
+                return 1;
+            }
+            threadCount = atoi(argv[++i]);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "-o")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "-o needs a file name.\n");
+                return 1;
+            }
+            outputFile = argv[++i];
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--checkpoint")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "--checkpoint needs a file name.\n");
+                return 1;
+            }
+            checkpointName = argv[++i];
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--every")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "--every needs a number.\n");
+                return 1;
+            }
+            every = atoi(argv[++i]);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--resume")) {
+            resume = true;
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--algo")) {
+            const char *name = (i + 1 < argc) ? argv[++i] : "";
+            if (0 == strcmp(name, "eller"))
+                algorithm = ELLER;
+            else if (0 == strcmp(name, "sidewinder"))
+                algorithm = SIDEWINDER;
+            else if (0 == strcmp(name, "binary"))
+                algorithm = BINARYTREE;
+            else {
+                fprintf(stderr, "--algo needs eller, sidewinder or binary.\n");
+                return 1;
+            }
+        }
+
+        if (0 == strcmp(argv[i], "--rows")) {
+            if (i + 2 >= argc) {
+                fprintf(stderr, "--rows needs the first row and the row after the last.\n");
+                return 1;
+            }
+            someRows = true;
+            rowsFrom = atoi(argv[++i]);
+            rowsTo = atoi(argv[++i]);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "a"))
+            type = ASCII;
+
+        if (0 == strcmp(argv[i], "b"))
+            type = BLOCK;
+
+        if (0 == strcmp(argv[i], "p"))
+            type = PACKED;
+    }
+
+    // Set numbers only mean something inside of a band and the file size
+    // can't be known when they are drawn
+    if (debugsets && (threadCount >= 0 || outputFile || algorithm != ELLER)) {
+        fprintf(stderr, "Set debug can only be used with the single thread "
+                        "Eller generator writing to stdout.\n");
+        return 1;
+    }
+    if ((checkpointName || someRows) && (threadCount >= 0 || algorithm != ELLER)) {
+        fprintf(stderr, "Checkpoints and --rows can only be used with the "
+                        "single thread Eller generator.\n");
+        return 1;
+    }
+    if (someRows && (rowsFrom >= rowsTo || rowsTo > height)) {
+        fprintf(stderr, "--rows must be inside of the maze.\n");
+        return 1;
+    }
+    // A few rows of a packed maze or a file are not a maze of their own
+    if (someRows && (type == PACKED || outputFile || resume)) {
+        fprintf(stderr, "--rows can only write ASCII or BLOCK rows to stdout.\n");
+        return 1;
+    }
+    if (resume && (!checkpointName || !outputFile)) {
+        fprintf(stderr, "--resume needs --checkpoint and -o.\n");
+        return 1;
+    }
+    if (checkpointName) {
+        if (resume || someRows) {
+            if (!openCheckpoints(checkpointName, height, &seed))
+                return 1;
+        } else if (every == 0) {
+            fprintf(stderr, "--checkpoint needs --every.\n");
+            return 1;
+        } else if (!createCheckpoints(checkpointName, height, every, seed)) {
+            return 1;
+        }
+    }
+
+    int cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1)
+        cores = 1;
+    if (threadCount == 0 || (threadCount < 0 && algorithm != ELLER))
+        threadCount = cores;
+
+    initOutput();
+    if (outputFile) {
+        if (!openFile(outputFile, type, height, resume))
+            return 1;
+        startRenderThreads(threadCount > 0 ? threadCount : cores);
+    } else if (type == PACKED) {
+        beginPacked(height);
+    }
+
+    if (threadCount > 0) {
+        generateBands(type, threadCount, seed);
+    } else {
+        // Create/init vars
+        Eller e;
+        e.init(width, false);
+        e.rng.seed(seed);
+        uint first = 0;
+        if (resume)
+            first = rowsFrom = loadCheckpoint(&e, height);
+        else if (checkpointName && someRows)
+            first = loadCheckpoint(&e, rowsFrom);
+        bool saving = checkpointName && !someRows;
+        generateRows(type, &e, first, rowsFrom, rowsTo, saving);
+        e.cleanup();
+    }
+
+    int result = 0;
+    if (fileMap) {
+        if (!finishFile())
+            result = 1;
+    } else {
+        if (type == PACKED)
+            endPacked();
+        flushOutput();
+    }
+
+    // Memory cleanup;
+    delete[]outBuffer;
+
+    return result;
+}
+#endif // GENMAZE_NO_MAIN
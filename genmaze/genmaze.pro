@@ -1,4 +1,6 @@
-CONFIG   = warn_on debug
-#CONFIG    = warn_on release
+CONFIG   = warn_on debug thread
+#CONFIG    = warn_on release thread
 SOURCES   = genmaze.cpp
 TARGET    = genmaze
+INCLUDEPATH += ../common
+HEADERS   = ../common/mazefile.h
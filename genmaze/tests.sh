@@ -0,0 +1,42 @@
+#!/bin/sh
+#
+# Checks of genmaze's command line.
+#
+# Usage: tests.sh [path to genmaze]
+
+GENMAZE=$(cd "$(dirname "${1:-./genmaze}")" && pwd)/$(basename "${1:-./genmaze}")
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+FAILED=0
+
+fail() {
+    echo "FAIL: $1"
+    FAILED=1
+}
+
+"$GENMAZE" 20 30 --seed 4 > ascii.txt || fail "plain ASCII maze"
+
+# A file name that is also an option must still only be a file name
+for name in a b p; do
+    "$GENMAZE" 20 30 --seed 4 -o $name || fail "-o $name"
+    cmp -s ascii.txt $name || fail "-o $name changed the maze style"
+    rm -f $name
+done
+for name in a b p; do
+    "$GENMAZE" 20 30 --seed 4 --checkpoint $name --every 5 -o out.txt \
+        || fail "--checkpoint $name"
+    cmp -s ascii.txt out.txt || fail "--checkpoint $name changed the maze style"
+    [ -f $name ] || fail "--checkpoint $name wrote no checkpoint"
+    rm -f $name out.txt
+done
+
+# Appending can't patch the checksum into the header, so it must come out
+# the same as through a pipe, with the checksum in a trailer
+"$GENMAZE" 20 10 --seed 1 p | cat > piped.bin
+: > appended.bin
+"$GENMAZE" 20 10 --seed 1 p >> appended.bin
+cmp -s piped.bin appended.bin || fail "appending a packed maze"
+
+[ $FAILED = 0 ] && echo "All genmaze tests passed."
+exit $FAILED
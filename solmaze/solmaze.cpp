@@ -74,34 +74,64 @@ Start|__|____________________|
  * modifications in only those two places to support any maze format.  One
  * could even takes this a step further and have this program input a
  * compressed maze and a wrapper shell script convert ascii maze data into
- * that format. QString's were used to store the data because they are simple
- * to use and not what the point of the problem was about.
+ * that format. The input is mapped (or read in big blocks from a pipe) and
+ * the lines are found in place, where the solution goes is only noted and
+ * the text is written back out untouched with the markers spliced in by
+ * writev.
  *
  * Enough on that, onto the more juicy stuff.  With the constrains that the 
  * maze will always be in a grid the most obvious choice for the internal data
- * is an array of data pointers.   Also because in a maze you never want to go
- * over the same area twice this turns into a directed graph.
+ * is a single block of cells, one row after another.   Also because in a maze
+ * you never want to go over the same area twice this turns into a directed
+ * graph.
  * 
- * Recursively  back track:
+ * Back track:
  *
  * This will find a solution, but it won't necessarily find the shortest
  * solution if there is more then one solution (i.e. a braid). It is fast for 
- * all types of mazes, and uses stack space up to the size of the Maze. If at 
- * a wall (or an area already plotted), return failure, else if at the finish,
- * return success, else recursively try moving in the four directions.  If 
- * returning success plot the current postion as part of the soltution path.
+ * all types of mazes, and uses a byte of its own stack for each cell on the
+ * path being tried (never the call stack). If at a wall (or an area already
+ * plotted), back up, else if at the finish, stop, else try moving in the
+ * four directions.  Once at the finish everything on the stack is the
+ * solution path.
  */
 
 #include <stdio.h>
-#include <readline/readline.h>
-#include <qstringlist.h>
-#include <qvector.h>
-#include <qtextstream.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "mazefile.h"
 
 // Buffer before maze starts
 #define BUFFER 5
 // char to use when filling in the path
 #define PATHMARKER 'X'
+// Size of the first block to read input that can't be mapped
+#define INPUTBLOCK (1 << 20)
+// Size of the blocks a maze is drawn out in with --redraw
+#define OUTPUTBLOCK (1 << 20)
+// How much of the mapped input --redraw lets go of at a time
+#define RELEASEBLOCK (8 << 20)
+// Most pieces handed to one writev()
+#define IOVBLOCK 1024
+// Rows of cells are lined up on this many bytes
+#define CACHELINE 64
 
 // The four properties a cell can have
 #define EMPTY 0
@@ -114,103 +144,727 @@ Start|__|____________________|
 // for other mazes
 #define CHECKEDFORBRAIDS
 
-#ifdef CHECKEDFORBRAIDS
-// Number to use when a cell is marked as already checked
-#define CHECKED  32
-#endif
+// The ways a maze can be solved
+enum SOLVER { DFS, BFS, ASTAR, FILL, TILES };
+
+/**
+ * A growing list of cell offsets.
+ */
+struct CellList {
+    size_t *cells;
+    size_t count, capacity;
+};
+
+inline void appendCell(CellList * list, size_t cell)
+{
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->cells = (size_t *) realloc(list->cells,
+                                         list->capacity * sizeof(size_t));
+    }
+    list->cells[list->count++] = cell;
+}
 
 struct maze {
-    // The char list of rows used in reading/writing/solution marking.
-    QList < QString > list;
+    // The text of the maze used in writing/solution marking.  It is either
+    // the input itself (mapped copy-on-write or read in whole) or drawn out
+    // of a packed maze.
+    char *text;
+    size_t textSize;
+    bool textMapped;
+    // The text is part of a --batch stream and isn't freed with the maze
+    bool textShared;
+    // How much of a mapped text has been let go by releaseText()
+    size_t textReleased;
+    // Where in text the solution markers go, the text itself is left alone
+    CellList marks;
+    // Where each line starts in text, with one extra entry past the end so
+    // that line i runs up to lines[i + 1] - 1.
+    char **lines;
+    uint lineCount, lineCapacity;
     // width/height of the maze
     uint width, height;
-    // A row or short's.  Each short is a cell that can be or'd with the
-    // four possible directions (UP | DOWN | LEFT | RIGHT).
-      QVector < short *>rows;
-    // The destination points
+    // All of the cells in one cache line aligned block, two bits each
+    // packed four to a byte the same way as a packed maze file (see
+    // cellAt()).  A cell only keeps if it opens RIGHT and DOWN
+    // (MAZEFILE_RIGHT and MAZEFILE_DOWN), ways() reads UP and LEFT from the
+    // cells above and to the left.
+    unsigned char *cells;
+    // One bit a cell for the solvers to mark where they have been
+    unsigned char *visited;
+    // With --redraw the text is let go once the cells are read, and the
+    // solution is kept as one bit a cell to draw the maze back out with
+    bool redraw;
+    unsigned char *solution;
+    // Cells from one row to the next and in the whole block, and how many
+    // the block has room for when it is used again for the next maze
+    size_t stride, cellCount, cellCapacity;
+    // The starting and destination points
+    uint startX, startY;
     uint destX, destY;
+    // Cells the astar solver expanded finding the path
+    size_t expanded;
 };
 
 /**
- * Convert three lines of text into one row 
+ * There is an empty row above the maze and one below it, and every row
+ * ends in at least one empty cell, so every cell has a neighbour in each
+ * direction to look at.
+ *
+ * @return where the cell (x,y) of maze m is in m->cells
+ */
+inline size_t cellAt(maze * m, uint x, uint y)
+{
+    return (size_t) (y + 1) * m->stride + x;
+}
+
+inline uint cellX(maze * m, size_t cell)
+{
+    return cell % m->stride;
+}
+
+inline uint cellY(maze * m, size_t cell)
+{
+    return cell / m->stride - 1;
+}
+
+/**
+ * @return the MAZEFILE_RIGHT and MAZEFILE_DOWN bits of cell
+ */
+inline uint openings(maze * m, size_t cell)
+{
+    return (m->cells[cell / 4] >> ((cell % 4) * 2)) & 3;
+}
+
+/**
+ * @return the ways out of cell (UP | DOWN | LEFT | RIGHT)
+ */
+inline int ways(maze * m, size_t cell)
+{
+    uint own = openings(m, cell);
+    return ((own & MAZEFILE_RIGHT) ? RIGHT : EMPTY)
+        | ((own & MAZEFILE_DOWN) ? DOWN : EMPTY)
+        | ((openings(m, cell - 1) & MAZEFILE_RIGHT) ? LEFT : EMPTY)
+        | ((openings(m, cell - m->stride) & MAZEFILE_DOWN) ? UP : EMPTY);
+}
+
+/**
+ * Open the MAZEFILE_RIGHT or MAZEFILE_DOWN side of cell.
+ */
+inline void openSide(maze * m, size_t cell, uint side)
+{
+    m->cells[cell / 4] |= side << ((cell % 4) * 2);
+}
+
+/**
+ * Wall off the way dir out of cell, from both sides.
+ */
+inline void closeWay(maze * m, size_t cell, int dir)
+{
+    switch (dir) {
+    case UP:    cell -= m->stride; dir = DOWN; break;
+    case LEFT:  cell -= 1; dir = RIGHT; break;
+    }
+    uint side = (dir == RIGHT) ? MAZEFILE_RIGHT : MAZEFILE_DOWN;
+    m->cells[cell / 4] &= ~(side << ((cell % 4) * 2));
+}
+
+inline bool onPath(maze * m, size_t cell)
+{
+    return m->solution[cell / 8] & (1 << (cell % 8));
+}
+
+inline bool isVisited(maze * m, size_t cell)
+{
+    return m->visited[cell / 8] & (1 << (cell % 8));
+}
+
+inline void visit(maze * m, size_t cell)
+{
+    m->visited[cell / 8] |= 1 << (cell % 8);
+}
+
+/**
+ * Make room for rows rows of width cells in maze m, each row padded out to
+ * a whole number of cache lines.
+ * @return false if there isn't enough memory
+ */
+bool allocateCells(maze * m, uint width, uint rows)
+{
+    size_t perLine = CACHELINE * 4;
+    m->stride = ((size_t) width + perLine) / perLine * perLine;
+    m->cellCount = ((size_t) rows + 2) * m->stride;
+    if (m->cells && m->cellCount <= m->cellCapacity) {
+        memset(m->cells, 0, m->cellCount / 4);
+        memset(m->visited, 0, m->cellCount / 8);
+        if (m->solution)
+            memset(m->solution, 0, m->cellCount / 8);
+        return true;
+    }
+    free(m->cells);
+    free(m->visited);
+    free(m->solution);
+    m->cells = m->visited = m->solution = NULL;
+    m->cellCapacity = 0;
+    void *cells = NULL;
+    void *visited = NULL;
+    if (posix_memalign(&cells, CACHELINE, m->cellCount / 4) != 0
+        || posix_memalign(&visited, CACHELINE, m->cellCount / 8) != 0
+        || (m->redraw && (m->solution = (unsigned char *)
+                          calloc(m->cellCount / 8, 1)) == NULL)) {
+        free(cells);
+        free(visited);
+        fprintf(stderr, "Not enough memory for a %u by %u maze.\n",
+                width, rows);
+        return false;
+    }
+    m->cells = (unsigned char *) cells;
+    m->visited = (unsigned char *) visited;
+    m->cellCapacity = m->cellCount;
+    // Keep the padding clear of any ways out
+    memset(cells, 0, m->cellCount / 4);
+    memset(visited, 0, m->cellCount / 8);
+    return true;
+}
+
+/**
+ * @return the length of line i in maze m, not counting the newline
+ */
+inline uint lineLength(maze * m, uint i)
+{
+    return m->lines[i + 1] - m->lines[i] - 1;
+}
+
+/**
+ * Convert two lines of text into row y of maze m, the line above having
+ * been done as the row before.
  *     _______________________  <- line a
  *    |     |        |        | <- line b
  *    |__   |_____   |  ______| <- line c
  *
- *    [08|06|08|12|06|10|12|04] <- example return
+ *    [08|06|08|12|06|10|12|04] <- example ways() of the row
  *
- *  @param a first row (already calculated last time by the function)
  *  @param b second row
  *  @param c third row
- *  @return array of the row with directions filled in
+ *  @param bLength length of b
+ *  @param cLength length of c
  */
-short *convertRow(short *a, const QString & b, const QString & c, uint width)
+void convertRow(maze * m, uint y, const char *b, const char *c,
+                uint bLength, uint cLength)
 {
-    // create a new row
-    short *row = new short[width];
+    size_t row = cellAt(m, 0, y);
+    bool bottom = (y == m->height);
     // fill each cell
-    for (uint i = 0; i < width; i++) {
-        // Don't waste time parsing string data, simply use the last row
-        // to init row[i] to UP or EMPTY.
-        // See if this call can move up
-        row[i] = (((a != NULL) && (a[i] & DOWN)) ? UP : EMPTY);
-
+    for (uint i = 0; i < m->width; i++) {
         // See if this cell can move down
-        if (c[i * 3 + BUFFER + 1] != '_')
-            row[i] |= DOWN;
+        uint down = i * 3 + BUFFER + 1;
+        if (!bottom && (down >= cLength || c[down] != '_'))
+            openSide(m, row + i, MAZEFILE_DOWN);
+
+        // See if the cell before can move right (and so this one left)
+        uint side = i * 3 + BUFFER;
+        if (i > 0 && (side >= bLength || b[side] != '|'))
+            openSide(m, row + i - 1, MAZEFILE_RIGHT);
+    }
+}
 
-        // Only parse Left/right data once and apply to both cells
-        // See if this cell can move left/right
-        if (!(b[i * 3 + BUFFER] == '|')) {
-            row[i] |= LEFT;
-            row[i - 1] |= RIGHT;
+/**
+ * With --redraw let go of the mapped input before p a block at a time so
+ * that all of it is never held at once.  Pages read again come back from
+ * the file.
+ */
+void releaseText(maze * m, const char *p)
+{
+    if (!m->redraw || !m->textMapped)
+        return;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t upTo = (p - m->text) / page * page;
+    if (upTo < m->textReleased + RELEASEBLOCK)
+        return;
+    madvise(m->text + m->textReleased, upTo - m->textReleased,
+            MADV_DONTNEED);
+    m->textReleased = upTo;
+}
+
+/**
+ * Find where each line of the text in maze m starts.
+ */
+void findLines(maze * m)
+{
+    char *end = m->text + m->textSize;
+    if (m->lineCapacity == 0) {
+        // Maze lines are all about as long as the first, so this is
+        // usually enough
+        char *first = (char *) memchr(m->text, '\n', m->textSize);
+        size_t length = (first == NULL) ? m->textSize + 1 : first - m->text + 1;
+        m->lineCapacity = m->textSize / length + 2;
+        m->lines = new char *[m->lineCapacity];
+    }
+    uint count = 0;
+    char *p = m->text;
+    while (p < end) {
+        if (count + 2 > m->lineCapacity) {
+            char **bigger = new char *[m->lineCapacity * 2];
+            memcpy(bigger, m->lines, count * sizeof(char *));
+            delete[]m->lines;
+            m->lines = bigger;
+            m->lineCapacity *= 2;
         }
+        m->lines[count++] = p;
+        p = (char *) memchr(p, '\n', end - p);
+        // No newline on the last line, pretend there is one
+        p = (p == NULL) ? end + 1 : p + 1;
     }
-    return row;
+    m->lines[count] = p;
+    m->lineCount = count;
 }
 
 /**
- * Read in (from stdin) a maze, parse, and fill m
+ * @return how many chars (with the newline) each line of maze m is when
+ * drawn by drawLine()
+ */
+inline size_t drawnLineSize(maze * m)
+{
+    // The margin, 3 chars per cell, one more and a newline
+    return BUFFER + (size_t) m->width * 3 + 2;
+}
+
+/**
+ * Draw line i of maze m at p the same way genmaze draws its ASCII mazes,
+ * with the solution marked if m->solution is kept.
+ * @return the end of the line
+ */
+char *drawLine(maze * m, uint i, char *p)
+{
+    memset(p, ' ', BUFFER);
+    p += BUFFER;
+    uint y = i / 2;
+    size_t row = cellAt(m, 0, y);
+
+    if (y > m->height) {
+        // The bottom of the maze
+        for (uint x = 0; x < m->width; x++) {
+            *p++ = (ways(m, row - m->stride + x) & LEFT) ? '_' : '|';
+            *p++ = '_';
+            *p++ = '_';
+        }
+        *p++ = '|';
+    } else if (i % 2 == 0) {
+        *p++ = (y == 0) ? ' ' : '|';
+        for (uint x = 0; x < m->width; x++) {
+            uint above = openings(m, row + x - m->stride);
+            bool aboveRight = (above & MAZEFILE_RIGHT);
+            bool right = (openings(m, row + x) & MAZEFILE_RIGHT);
+            char floor = (above & MAZEFILE_DOWN) ? ' ' : '_';
+            *p++ = floor;
+            *p++ = floor;
+            if (aboveRight && !right)
+                *p++ = ' ';
+            else
+                *p++ = (y != 0 && !aboveRight) ? '|' : '_';
+        }
+    } else {
+        *p++ = '|';
+        for (uint x = 0; x < m->width; x++) {
+            char mark = (m->solution && onPath(m, row + x)) ? PATHMARKER : ' ';
+            *p++ = mark;
+            *p++ = mark;
+            *p++ = (openings(m, row + x) & MAZEFILE_RIGHT) ? ' ' : '|';
+        }
+    }
+    *p++ = '\n';
+    return p;
+}
+
+/**
+ * Build the ascii text for maze m out of its rows.
+ */
+void buildText(maze * m)
+{
+    uint lines = (m->height + 1) * 2 + 1;
+    m->textSize = drawnLineSize(m) * lines;
+    m->text = (char *) malloc(m->textSize);
+    m->textMapped = false;
+    m->textShared = false;
+    char *p = m->text;
+    for (uint i = 0; i < lines; i++)
+        p = drawLine(m, i, p);
+    findLines(m);
+}
+
+/**
+ * Parse the packed maze (see mazefile.h) in data into m.
+ * @return false if the maze is damaged
  */
-void read(maze * m)
+bool readPacked(maze * m, const unsigned char *data, size_t size)
 {
-    uint lineNumber = 0;
-    char *line = 0;
-    while ((line = readline(NULL)) != NULL) {
-        m->list.append(line);
-        // Don't leak memory after saving line.
-        free(line);
+    MazeFileHeader h;
+    if (size < MAZEFILE_HEADERSIZE || !mazeFileReadHeader(data, &h)) {
+        fprintf(stderr, "Unknown packed maze header.\n");
+        return false;
+    }
+    if (h.startX >= h.width || h.endX >= h.width
+        || h.startY >= h.height || h.endY >= h.height) {
+        fprintf(stderr, "Packed maze start or end is outside of the maze.\n");
+        return false;
+    }
+    // Don't make room for more rows than there are (dividing so that a
+    // huge width and height can't overflow)
+    size_t rowBytes = mazeFileRowBytes(h.width);
+    size_t trailer = (h.flags & MAZEFILE_TRAILER) ? 4 : 0;
+    if (size - MAZEFILE_HEADERSIZE < trailer
+        || rowBytes > (size - MAZEFILE_HEADERSIZE - trailer) / h.height) {
+        fprintf(stderr, "Packed maze is missing rows.\n");
+        return false;
+    }
+
+    if (!allocateCells(m, h.width, h.height))
+        return false;
+    const unsigned char *next = data + MAZEFILE_HEADERSIZE;
+    uint32_t checksum = MAZEFILE_CHECKSUM_INIT;
+    m->width = h.width;
+    m->height = h.height - 1;
+    for (uint y = 0; y < h.height; y++) {
+        const unsigned char *packed = next;
+        next += rowBytes;
+        checksum = mazeFileChecksum(checksum, packed, rowBytes);
+
+        // The rows are laid out the same, but don't let the edges be open
+        // to the outside of the maze
+        size_t row = cellAt(m, 0, y);
+        memcpy(m->cells + row / 4, packed, rowBytes);
+        if (h.width % 4)
+            m->cells[(row + h.width) / 4] &= (1 << ((h.width % 4) * 2)) - 1;
+        closeWay(m, row + h.width - 1, RIGHT);
+        if (y == h.height - 1)
+            for (uint x = 0; x < h.width; x++)
+                closeWay(m, row + x, DOWN);
+    }
+    m->startX = h.startX;
+    m->startY = h.startY;
+    m->destX = h.endX;
+    m->destY = h.endY;
 
-        if (lineNumber == 1)
-            m->width = (m->list[1].length() - BUFFER) / 3;
+    if (h.flags & MAZEFILE_TRAILER)
+        h.checksum = mazeFileGet32(next);
+    if (checksum != h.checksum) {
+        fprintf(stderr, "Packed maze checksum does not match.\n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Get all of fd into memory.  A regular file is mapped private so the
+ * solution can be marked straight into it, anything else is read in large
+ * blocks.
+ * @return false if nothing could be read
+ */
+bool readInput(maze * m, int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+        && st.st_size > 0 && lseek(fd, 0, SEEK_CUR) == 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            m->text = (char *) map;
+            m->textSize = st.st_size;
+            m->textMapped = true;
+            m->textShared = false;
+            return true;
+        }
+    }
 
-        // On the third line figuring out a row
-        if (lineNumber++ % 2 != 0 || lineNumber <= 2)
+    size_t capacity = INPUTBLOCK;
+    size_t size = 0;
+    char *buffer = (char *) malloc(capacity);
+    for (;;) {
+        if (size == capacity) {
+            capacity *= 2;
+            char *bigger = (char *) realloc(buffer, capacity);
+            if (bigger == NULL) {
+                free(buffer);
+                fprintf(stderr, "Not enough memory to read the maze.\n");
+                return false;
+            }
+            buffer = bigger;
+        }
+        ssize_t got = read(fd, buffer + size, capacity - size);
+        if (got < 0 && errno == EINTR)
             continue;
-        short *lastRow = NULL;
-        if (lineNumber > 3)
-            lastRow = m->rows[lineNumber / 2 - 2];
-        short *col = convertRow(lastRow,
-                                m->list[lineNumber - 2],
-                                m->list[lineNumber - 1], m->width);
-        if (m->rows.size() <= (int) (lineNumber / 2))
-            m->rows.resize(lineNumber * 4);
-        m->rows.insert((lineNumber / 2) - 1, col);
+        if (got <= 0)
+            break;
+        size += got;
+    }
+    if (size == 0) {
+        free(buffer);
+        return false;
+    }
+    m->text = buffer;
+    m->textSize = size;
+    m->textMapped = false;
+    m->textShared = false;
+    return true;
+}
+
+/**
+ * Release the text of maze m.
+ */
+void freeText(maze * m)
+{
+    if (m->text == NULL)
+        return;
+    if (m->textMapped)
+        munmap(m->text, m->textSize);
+    else if (!m->textShared)
+        free(m->text);
+    m->text = NULL;
+}
+
+/**
+ * Set the width of maze m from the length of its first row of cells.
+ * @return false if the row is too short to hold a cell
+ */
+bool checkWidth(maze * m, uint length)
+{
+    // The margin, a wall and three chars for each cell
+    if (length < BUFFER + 3) {
+        fprintf(stderr, "Input is too short to be a maze.\n");
+        return false;
+    }
+    m->width = (length - BUFFER) / 3;
+    return true;
+}
+
+/**
+ * Make room for rows rows in maze m, keeping the rows it has.
+ * @return false if there isn't enough memory
+ */
+bool growCells(maze * m, uint rows)
+{
+    unsigned char *cells = m->cells;
+    size_t bytes = m->cellCount / 4;
+    // So that allocateCells() leaves the old block alone
+    m->cells = NULL;
+    if (!allocateCells(m, m->width, rows)) {
+        free(cells);
+        return false;
+    }
+    memcpy(m->cells, cells, bytes);
+    free(cells);
+    return true;
+}
+
+/**
+ * With --redraw read the rows of the ascii text of maze m in one pass,
+ * letting go of the text behind them as it goes, without keeping where
+ * every line starts.
+ * @return false if it isn't a maze
+ */
+bool convertLines(maze * m)
+{
+    char *end = m->text + m->textSize;
+    char *line = m->text;
+    // The line of the row being read and its length
+    char *b = NULL;
+    uint bLength = 0;
+    uint rows = 0, rowCount = 0;
+    // No row is the bottom one until the last is known
+    m->height = (uint) -1;
+    m->textReleased = 0;
+    for (uint i = 0; line < end; i++) {
+        char *next = (char *) memchr(line, '\n', end - line);
+        next = (next == NULL) ? end : next + 1;
+        uint length = next - line - (next[-1] == '\n');
+        if (i == 1) {
+            // Maze lines are all about as long as this one
+            if (!checkWidth(m, length))
+                return false;
+            rows = m->textSize / (length + 1) / 2 + 1;
+            if (!allocateCells(m, m->width, rows))
+                return false;
+        }
+        if (i % 2 == 1) {
+            b = line;
+            bLength = length;
+        } else if (i > 0) {
+            if (rowCount == rows && !growCells(m, rows *= 2))
+                return false;
+            convertRow(m, rowCount++, b, line, bLength, length);
+            releaseText(m, b);
+        }
+        line = next;
+    }
+    if (rowCount == 0) {
+        fprintf(stderr, "Input is too short to be a maze.\n");
+        return false;
+    }
+
+    // Only the rows read are part of the maze
+    m->height = rowCount - 1;
+    m->cellCount = ((size_t) rowCount + 2) * m->stride;
+    size_t row = cellAt(m, 0, m->height);
+    for (uint x = 0; x < m->width; x++)
+        closeWay(m, row + x, DOWN);
+    return true;
+}
+
+/**
+ * Parse the maze in m->text and fill m
+ * @return false if the maze couldn't be read
+ */
+bool parse(maze * m)
+{
+    if (m->text[0] == MAZEFILE_MAGIC[0]) {
+        bool ok = readPacked(m, (const unsigned char *) m->text, m->textSize);
+        freeText(m);
+        if (ok && !m->redraw)
+            buildText(m);
+        return ok;
     }
-    m->rows.resize(lineNumber / 2);
-    m->height = lineNumber / 2 - 1;
+
+    if (m->redraw) {
+        if (!convertLines(m))
+            return false;
+        freeText(m);
+    } else {
+        findLines(m);
+        uint lineCount = m->lineCount;
+        // Every row is made from the two lines below the line above it
+        uint rowCount = (lineCount > 0) ? (lineCount - 1) / 2 : 0;
+        if (rowCount == 0 || !checkWidth(m, lineLength(m, 1))
+            || !allocateCells(m, m->width, rowCount))
+            return false;
+        m->height = rowCount - 1;
+        for (uint y = 0; y < rowCount; y++) {
+            uint line = y * 2 + 1;
+            convertRow(m, y, m->lines[line], m->lines[line + 1],
+                       lineLength(m, line), lineLength(m, line + 1));
+        }
+    }
+
+    // Start in the bottom left and end in the top right
+    m->destX = m->width - 1;
+    m->destY = 0;
+    m->startX = 0;
+    m->startY = m->height;
+    return true;
+}
+
+/**
+ * Read in (from stdin) a maze, parse, and fill m
+ * @return false if the maze couldn't be read
+ */
+bool read(maze * m)
+{
+    return readInput(m, STDIN_FILENO) && parse(m);
+}
+
+/**
+ * Sort cell offsets from lowest to highest.
+ */
+int compareOffsets(const void *a, const void *b)
+{
+    size_t x = *(const size_t *) a;
+    size_t y = *(const size_t *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * writev() all of iov to fd, however many calls it takes.
+ * @return false if it couldn't all be written
+ */
+bool writeAll(int fd, struct iovec *iov, int count)
+{
+    while (count > 0) {
+        ssize_t wrote = writev(fd, iov, count);
+        if (wrote < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        while (count > 0 && (size_t) wrote >= iov->iov_len) {
+            wrote -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + wrote;
+            iov->iov_len -= wrote;
+        }
+    }
+    return true;
 }
 
 /**
- * Write maze m to stdout.
+ * Write all of iov to out.  Only stdout is written to straight, anything
+ * else (a --batch or --serve answer) goes through stdio.
  */
-void write(maze * m)
+void writeOut(FILE * out, struct iovec *iov, int count)
 {
-    QTextStream cout(stdout, QIODevice::WriteOnly);
-    QList < QString >::Iterator it;
-    for (it = m->list.begin(); it != m->list.end(); ++it) {
-        cout << (*it) << endl;
+    if (out != stdout) {
+        for (int i = 0; i < count; i++)
+            fwrite(iov[i].iov_base, 1, iov[i].iov_len, out);
+        return;
+    }
+    if (!writeAll(STDOUT_FILENO, iov, count))
+        perror("solmaze: writev");
+}
+
+/**
+ * Write maze m to out.
+ */
+void write(maze * m, FILE * out)
+{
+    if (m->text == NULL) {
+        // Draw it back out a block of lines at a time
+        size_t lineSize = drawnLineSize(m);
+        size_t blockLines = OUTPUTBLOCK / lineSize + 1;
+        char *block = (char *) malloc(blockLines * lineSize);
+        uint lines = (m->height + 1) * 2 + 1;
+        for (uint i = 0; i < lines;) {
+            char *p = block;
+            for (uint n = 0; n < blockLines && i < lines; n++)
+                p = drawLine(m, i++, p);
+            fwrite(block, 1, p - block, out);
+        }
+        free(block);
+        return;
+    }
+
+    // Send the text as it is with the markers spliced in
+    static char markers[2] = { PATHMARKER, PATHMARKER };
+    static char newline[1] = { '\n' };
+    qsort(m->marks.cells, m->marks.count, sizeof(size_t), compareOffsets);
+    struct iovec iov[IOVBLOCK];
+    int count = 0;
+    size_t done = 0;
+    for (size_t i = 0; i < m->marks.count; i++) {
+        size_t mark = m->marks.cells[i];
+        if (mark < done || mark + 2 > m->textSize)
+            continue;
+        if (count + 2 > IOVBLOCK) {
+            writeOut(out, iov, count);
+            count = 0;
+        }
+        iov[count].iov_base = m->text + done;
+        iov[count++].iov_len = mark - done;
+        iov[count].iov_base = markers;
+        iov[count++].iov_len = 2;
+        done = mark + 2;
+    }
+    if (count + 2 > IOVBLOCK) {
+        writeOut(out, iov, count);
+        count = 0;
     }
+    iov[count].iov_base = m->text + done;
+    iov[count++].iov_len = m->textSize - done;
+    if (m->textSize > 0 && m->text[m->textSize - 1] != '\n') {
+        iov[count].iov_base = newline;
+        iov[count++].iov_len = 1;
+    }
+    writeOut(out, iov, count);
 }
 
 /**
@@ -218,89 +872,2847 @@ void write(maze * m)
  */
 inline void solutionCell(maze * m, int x, int y)
 {
-    m->list[y * 2 + 1][x * 3 + BUFFER + 1] = PATHMARKER;
-    m->list[y * 2 + 1][x * 3 + BUFFER + 2] = PATHMARKER;
+    if (m->solution) {
+        size_t cell = cellAt(m, x, y);
+        m->solution[cell / 8] |= 1 << (cell % 8);
+        return;
+    }
+    appendCell(&m->marks, m->lines[y * 2 + 1] + x * 3 + BUFFER + 1 - m->text);
+}
+
+/**
+ * @return the direction that undoes dir
+ */
+inline int opposite(int dir)
+{
+    return (dir & (UP | LEFT)) ? dir << 1 : dir >> 1;
+}
+
+/**
+ * Move (x,y) one cell in the direction dir.
+ */
+inline void step(int dir, uint & x, uint & y)
+{
+    switch (dir) {
+    case UP:    y--; break;
+    case DOWN:  y++; break;
+    case LEFT:  x--; break;
+    case RIGHT: x++; break;
+    }
 }
 
+// The order solveMaze() tries the ways out of a cell in
+static const int tryOrder[4] = { LEFT, UP, DOWN, RIGHT };
+
+// A stack frame of solveMaze() is one byte, the direction it came into the
+// cell by in the low four bits and how many of tryOrder it has tried in the
+// high four.
+#define FRAME(from, tried) ((unsigned char) ((from) | ((tried) << 4)))
+#define FRAMEFROM(f) ((f) & 15)
+#define FRAMETRIED(f) ((f) >> 4)
+// Starting size of the solveMaze() stack
+#define STACKBLOCK 4096
+
 /**
- * Check if the next cell at point (x,y) coming from the previous
- * cell parent the direction from to see if it is the end of maze m.
- * If it isn't try the cells other directions to see if they lead there.
+ * Search from the point (x,y) for the end of maze m, backing up at walls
+ * and at cells that were already checked, and mark the solution if the
+ * end is found.  The path being explored is kept in its own stack rather
+ * than on the call stack, so the size of the maze doesn't matter.
  *
  * @param x - the starting xcord
  * @param y - the starting ycord
- * @param from - direction just came from
- * @return true if x,y is part of the solution.
+ * @return true if a path to the end was found.
  */
-bool solveMaze(maze * m, uint x, uint y, int from)
+bool solveMaze(maze * m, uint x, uint y)
 {
-    // This if shouldn't be needed if read() performed correctly
-    //if( m->height < y || x > m->width )
-    //      return;
+    // How far apart neighbouring cells are in m->cells, by direction
+    ptrdiff_t offset[RIGHT + 1] = { 0 };
+    offset[UP] = -(ptrdiff_t) m->stride;
+    offset[DOWN] = m->stride;
+    offset[LEFT] = -1;
+    offset[RIGHT] = 1;
 
-    short cell = m->rows[y][x];
+    size_t capacity = STACKBLOCK;
+    size_t depth = 0;
+    unsigned char *stack = (unsigned char *) malloc(capacity);
+    size_t at = cellAt(m, x, y);
+    size_t dest = cellAt(m, m->destX, m->destY);
 
 #ifdef CHECKEDFORBRAIDS
-    if (cell & CHECKED)
-        return false;
-    m->rows[y][x] |= CHECKED;
+    visit(m, at);
 #endif
+    stack[depth++] = FRAME(EMPTY, 0);
+    while (depth > 0 && at != dest) {
+        unsigned char frame = stack[depth - 1];
+        int from = FRAMEFROM(frame);
+        uint tried = FRAMETRIED(frame);
+        int cell = ways(m, at);
+        int dir = EMPTY;
+        while (tried < 4) {
+            // Don't go back the way you just came
+            int way = tryOrder[tried++];
+            if (from == opposite(way) || !(cell & way))
+                continue;
+#ifdef CHECKEDFORBRAIDS
+            if (isVisited(m, at + offset[way]))
+                continue;
+#endif
+            dir = way;
+            break;
+        }
+        if (dir == EMPTY) {
+            // Nothing left to try here, back up to the cell before
+            depth--;
+            at -= offset[from];
+            continue;
+        }
+        stack[depth - 1] = FRAME(from, tried);
 
-    if (x == m->destX && y == m->destY) {
-        // Don't bother checking its children
-        solutionCell(m, x, y);
-        return true;
+        at += offset[dir];
+#ifdef CHECKEDFORBRAIDS
+        visit(m, at);
+#endif
+        if (depth == capacity) {
+            capacity *= 2;
+            stack = (unsigned char *) realloc(stack, capacity);
+        }
+        stack[depth++] = FRAME(dir, 0);
     }
 
-    bool foundEnd = false;
+    // Everything on the stack is on the path, mark it walking back
+    bool foundEnd = (depth > 0);
+    if (foundEnd) {
+        x = m->destX;
+        y = m->destY;
+        while (depth > 0) {
+            solutionCell(m, x, y);
+            step(opposite(FRAMEFROM(stack[--depth])), x, y);
+        }
+    }
+    free(stack);
+    return foundEnd;
+}
 
-    // Don't go back the way you just came
-    if (from != RIGHT && cell & LEFT)
-        foundEnd = solveMaze(m, x - 1, y, LEFT);
-    if (!foundEnd && (from != DOWN && (cell & UP)))
-        foundEnd = solveMaze(m, x, y - 1, UP);
-    if (!foundEnd && (from != UP && (cell & DOWN)))
-        foundEnd = solveMaze(m, x, y + 1, DOWN);
-    if (!foundEnd && (from != LEFT && (cell & RIGHT)))
-        foundEnd = solveMaze(m, x + 1, y, RIGHT);
-
-    // If this is on the path mark it
-    if (foundEnd)
-        solutionCell(m, x, y);
+// Starting size of a Frontier, a power of two
+#define FRONTIERBLOCK 4096
 
-    return foundEnd;
+/**
+ * A first in first out ring of cell offsets for the breadth first searches,
+ * doubled when it fills up.
+ */
+struct Frontier {
+    size_t *ring;
+    size_t capacity, head, count;
+};
+
+void initFrontier(Frontier * f)
+{
+    f->capacity = FRONTIERBLOCK;
+    f->head = f->count = 0;
+    f->ring = (size_t *) malloc(f->capacity * sizeof(size_t));
+}
+
+inline void pushFrontier(Frontier * f, size_t cell)
+{
+    if (f->count == f->capacity) {
+        // Unwrap the ring into the bottom half of a bigger one
+        f->ring = (size_t *) realloc(f->ring,
+                                     f->capacity * 2 * sizeof(size_t));
+        memcpy(f->ring + f->capacity, f->ring, f->head * sizeof(size_t));
+        f->capacity *= 2;
+    }
+    f->ring[(f->head + f->count) & (f->capacity - 1)] = cell;
+    f->count++;
+}
+
+inline size_t popFrontier(Frontier * f)
+{
+    size_t cell = f->ring[f->head];
+    f->head = (f->head + 1) & (f->capacity - 1);
+    f->count--;
+    return cell;
 }
 
 /**
- * Read in an ascii maze, solve it and output it with the solution.
- * @return 1 if there is no path found.
+ * Fill offset with how far apart neighbouring cells are in m->cells, by
+ * index in tryOrder.
  */
-int main(int /* argc */ , char * /* argv[] */ )
+void tryOffsets(maze * m, ptrdiff_t offset[4])
 {
-    maze m;
-    m.width = m.height = 0;
-    m.rows.resize(2);
+    for (int i = 0; i < 4; i++) {
+        switch (tryOrder[i]) {
+        case UP:    offset[i] = -(ptrdiff_t) m->stride; break;
+        case DOWN:  offset[i] = m->stride; break;
+        case LEFT:  offset[i] = -1; break;
+        case RIGHT: offset[i] = 1; break;
+        }
+    }
+}
 
-    // Read the maze
-    read(&m);
+/**
+ * Search outwards from the point (x,y) one step at a time so that the end
+ * of maze m is reached by a shortest path, even when the maze has loops.
+ * Each cell reached keeps the way it was entered (its index in tryOrder)
+ * in two bits, the path is marked by following those back from the end.
+ *
+ * @param x - the starting xcord
+ * @param y - the starting ycord
+ * @return true if a path to the end was found.
+ */
+bool solveBreadthFirst(maze * m, uint x, uint y)
+{
+    ptrdiff_t offset[4];
+    tryOffsets(m, offset);
+    unsigned char *parents = (unsigned char *) calloc(m->cellCount / 4, 1);
 
-    // Choose start and ending points for the maze
-    m.destX = m.width - 1;
-    m.destY = 0;
-    uint startX = 0;
-    uint startY = m.height;
+    Frontier frontier;
+    initFrontier(&frontier);
+    size_t start = cellAt(m, x, y);
+    size_t dest = cellAt(m, m->destX, m->destY);
+    bool foundEnd = (start == dest);
 
-    // Attempt to find the solution
-    int isSolvable = solveMaze(&m, startX, startY, EMPTY);
+    visit(m, start);
+    pushFrontier(&frontier, start);
+    while (frontier.count > 0 && !foundEnd) {
+        size_t at = popFrontier(&frontier);
+        int cell = ways(m, at);
+        for (int i = 0; i < 4; i++) {
+            if (!(cell & tryOrder[i]))
+                continue;
+            size_t next = at + offset[i];
+            if (isVisited(m, next))
+                continue;
+            visit(m, next);
+            parents[next / 4] |= i << ((next % 4) * 2);
+            if (next == dest) {
+                foundEnd = true;
+                break;
+            }
+            pushFrontier(&frontier, next);
+        }
+    }
 
+    if (foundEnd) {
+        x = m->destX;
+        y = m->destY;
+        size_t at = dest;
+        while (at != start) {
+            solutionCell(m, x, y);
+            int i = (parents[at / 4] >> ((at % 4) * 2)) & 3;
+            step(opposite(tryOrder[i]), x, y);
+            at -= offset[i];
+        }
+        solutionCell(m, x, y);
+    }
+    free(frontier.ring);
+    free(parents);
+    return foundEnd;
+}
+
+/*
+ * A*:
+ *
+ * Cells come out of a bucket queue in order of the steps taken to get to
+ * them plus the Manhattan distance left to the end, which never over
+ * guesses, so the first time the end comes out it was reached by a
+ * shortest path.  Rather than queueing every cell, a search follows a
+ * corridor (a cell with exactly two ways out) straight through to the next
+ * junction, dead end or the end of the maze and only queues that.
+ */
+
+/**
+ * A queue of cells by estimate, bucket i holding the cells with the
+ * estimate first + i newest last.  Estimates never go down so current only
+ * moves forward.
+ */
+struct BucketQueue {
+    CellList *buckets;
+    size_t bucketCount, current;
+    uint32_t first;
+};
+
+void pushBucket(BucketQueue * q, size_t cell, uint32_t estimate)
+{
+    size_t b = estimate - q->first;
+    if (b >= q->bucketCount) {
+        size_t grown = q->bucketCount ? q->bucketCount : 64;
+        while (grown <= b)
+            grown *= 2;
+        q->buckets = (CellList *) realloc(q->buckets,
+                                          grown * sizeof(CellList));
+        memset(q->buckets + q->bucketCount, 0,
+               (grown - q->bucketCount) * sizeof(CellList));
+        q->bucketCount = grown;
+    }
+    appendCell(&q->buckets[b], cell);
+}
+
+/**
+ * Take the newest cell with the lowest estimate out of q.
+ * @return false if q is empty
+ */
+bool popBucket(BucketQueue * q, size_t * cell)
+{
+    while (q->current < q->bucketCount && q->buckets[q->current].count == 0)
+        q->current++;
+    if (q->current == q->bucketCount)
+        return false;
+    CellList *bucket = &q->buckets[q->current];
+    *cell = bucket->cells[--bucket->count];
+    return true;
+}
+
+inline uint32_t manhattan(maze * m, size_t cell)
+{
+    uint x = cellX(m, cell);
+    uint y = cellY(m, cell);
+    return (x > m->destX ? x - m->destX : m->destX - x)
+        + (y > m->destY ? y - m->destY : m->destY - y);
+}
+
+/**
+ * Search from the point (x,y) with A* for a shortest path to the end of
+ * maze m, counting in m->expanded how many cells were expanded.
+ *
+ * @param x - the starting xcord
+ * @param y - the starting ycord
+ * @return true if a path to the end was found.
+ */
+bool solveAStar(maze * m, uint x, uint y)
+{
+    ptrdiff_t offset[4];
+    tryOffsets(m, offset);
+    unsigned char *parents = (unsigned char *) calloc(m->cellCount / 4, 1);
+    // Steps taken to each cell, all ones until it is reached
+    uint32_t *steps = (uint32_t *) malloc(m->cellCount * sizeof(uint32_t));
+    memset(steps, 0xff, m->cellCount * sizeof(uint32_t));
+
+    size_t start = cellAt(m, x, y);
+    size_t dest = cellAt(m, m->destX, m->destY);
+    BucketQueue queue;
+    queue.buckets = NULL;
+    queue.bucketCount = queue.current = 0;
+    queue.first = manhattan(m, start);
+    size_t expanded = 0;
+    bool foundEnd = false;
+
+    steps[start] = 0;
+    pushBucket(&queue, start, queue.first);
+    size_t at;
+    while (popBucket(&queue, &at)) {
+        if (isVisited(m, at))
+            continue;
+        visit(m, at);
+        expanded++;
+        if (at == dest) {
+            foundEnd = true;
+            break;
+        }
+
+        // Follow each way out down its corridor, queueing where it stops
+        int cell = ways(m, at);
+        for (int i = 0; i < 4; i++) {
+            if (!(cell & tryOrder[i]))
+                continue;
+            size_t walk = at + offset[i];
+            uint32_t taken = steps[at] + 1;
+            int dir = i;
+            // Stop if this isn't a shorter way to get here
+            while (taken < steps[walk]) {
+                steps[walk] = taken;
+                int shift = (walk % 4) * 2;
+                parents[walk / 4] = (parents[walk / 4] & ~(3 << shift))
+                    | (dir << shift);
+                int through = ways(m, walk);
+                if (walk == dest || __builtin_popcount(through) != 2) {
+                    pushBucket(&queue, walk, taken + manhattan(m, walk));
+                    break;
+                }
+                // Leave by the way that isn't back
+                int back = opposite(tryOrder[dir]);
+                for (dir = 0; dir < 4; dir++)
+                    if ((through & tryOrder[dir]) && tryOrder[dir] != back)
+                        break;
+                walk += offset[dir];
+                taken++;
+            }
+        }
+    }
+
+    if (foundEnd) {
+        x = m->destX;
+        y = m->destY;
+        at = dest;
+        while (at != start) {
+            solutionCell(m, x, y);
+            int i = (parents[at / 4] >> ((at % 4) * 2)) & 3;
+            step(opposite(tryOrder[i]), x, y);
+            at -= offset[i];
+        }
+        solutionCell(m, x, y);
+    }
+    m->expanded = expanded;
+
+    for (size_t b = 0; b < queue.bucketCount; b++)
+        free(queue.buckets[b].cells);
+    free(queue.buckets);
+    free(steps);
+    free(parents);
+    return foundEnd;
+}
+
+/*
+ * Dead end filling:
+ *
+ * A cell other than the start or end with only one way out can't be on
+ * the path, so it is walled off, which can leave the cell it opened onto
+ * a dead end in turn.  All of the first dead ends are found by scanning
+ * the whole grid many cells at a time (with AVX2 or SSE2 when the cpu has
+ * them), after that each wave of filling hands the next wave the cells it
+ * turned into dead ends.  What is left of a perfect maze is just the path,
+ * which solveMaze() then walks without ever having to back up.
+ */
+
+/**
+ * Add every cell of maze m with exactly one way out to deadEnds, one cell
+ * at a time.
+ */
+void findDeadEnds(maze * m, CellList * deadEnds)
+{
+    size_t end = cellAt(m, 0, m->height + 1);
+    for (size_t i = cellAt(m, 0, 0); i < end; i++) {
+        int way = ways(m, i);
+        if (way != 0 && (way & (way - 1)) == 0)
+            appendCell(deadEnds, i);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Every other bit, where the MAZEFILE_RIGHT bits of 32 cells sit in a word
+#define EVENBITS 0x5555555555555555LL
+
+/**
+ * Add the cells of word (32 cells) that are set in bits (every other bit)
+ * to deadEnds.
+ */
+inline void appendDeadEnds(CellList * deadEnds, size_t word, uint64_t bits)
+{
+    while (bits) {
+        appendCell(deadEnds, word * 32 + __builtin_ctzll(bits) / 2);
+        bits &= bits - 1;
+    }
+}
+
+/*
+ * The vector scans work straight on the packed cells, 64 bits (32 cells)
+ * to a lane.  The ways out of the cells in a lane are its own RIGHT and
+ * DOWN bits, the RIGHT bits shifted up a cell (pulling in the top cell of
+ * the lane before) for LEFT and the DOWN bits of the same lane a row up
+ * for UP.  Adding those four one bit numbers without carrying gives the
+ * cells with exactly one way out.  The padding row above the maze and the
+ * empty cell on the end of every row keep every lane read inside the grid
+ * and the padding from ever looking like a dead end.
+ */
+
+/**
+ * findDeadEnds() 64 cells at a time.
+ */
+__attribute__ ((target("sse2")))
+void findDeadEndsSSE2(maze * m, CellList * deadEnds)
+{
+    const uint64_t *words = (const uint64_t *) m->cells;
+    size_t rowWords = m->stride / 32;
+    size_t end = cellAt(m, 0, m->height + 1) / 32;
+    const __m128i even = _mm_set1_epi64x(EVENBITS);
+    const __m128i zero = _mm_setzero_si128();
+    for (size_t w = cellAt(m, 0, 0) / 32; w < end; w += 2) {
+        __m128i cells = _mm_load_si128((const __m128i *) (words + w));
+        __m128i before = _mm_loadu_si128((const __m128i *) (words + w - 1));
+        __m128i above = _mm_load_si128((const __m128i *)
+                                       (words + w - rowWords));
+        __m128i right = _mm_and_si128(cells, even);
+        __m128i down = _mm_and_si128(_mm_srli_epi64(cells, 1), even);
+        __m128i left = _mm_or_si128(_mm_slli_epi64(right, 2),
+                                    _mm_srli_epi64(_mm_and_si128(before, even),
+                                                   62));
+        __m128i up = _mm_and_si128(_mm_srli_epi64(above, 1), even);
+        __m128i s1 = _mm_xor_si128(right, down);
+        __m128i s2 = _mm_xor_si128(left, up);
+        __m128i carry = _mm_or_si128(_mm_or_si128(_mm_and_si128(right, down),
+                                                  _mm_and_si128(left, up)),
+                                     _mm_and_si128(s1, s2));
+        __m128i dead = _mm_andnot_si128(carry, _mm_xor_si128(s1, s2));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(dead, zero)) == 0xffff)
+            continue;
+        uint64_t lanes[2];
+        _mm_storeu_si128((__m128i *) lanes, dead);
+        for (int i = 0; i < 2; i++)
+            appendDeadEnds(deadEnds, w + i, lanes[i]);
+    }
+}
+
+/**
+ * findDeadEnds() 128 cells at a time.
+ */
+__attribute__ ((target("avx2")))
+void findDeadEndsAVX2(maze * m, CellList * deadEnds)
+{
+    const uint64_t *words = (const uint64_t *) m->cells;
+    size_t rowWords = m->stride / 32;
+    size_t end = cellAt(m, 0, m->height + 1) / 32;
+    const __m256i even = _mm256_set1_epi64x(EVENBITS);
+    for (size_t w = cellAt(m, 0, 0) / 32; w < end; w += 4) {
+        __m256i cells = _mm256_load_si256((const __m256i *) (words + w));
+        __m256i before = _mm256_loadu_si256((const __m256i *)
+                                            (words + w - 1));
+        __m256i above = _mm256_load_si256((const __m256i *)
+                                          (words + w - rowWords));
+        __m256i right = _mm256_and_si256(cells, even);
+        __m256i down = _mm256_and_si256(_mm256_srli_epi64(cells, 1), even);
+        __m256i left = _mm256_or_si256(_mm256_slli_epi64(right, 2),
+                                       _mm256_srli_epi64(_mm256_and_si256
+                                                         (before, even), 62));
+        __m256i up = _mm256_and_si256(_mm256_srli_epi64(above, 1), even);
+        __m256i s1 = _mm256_xor_si256(right, down);
+        __m256i s2 = _mm256_xor_si256(left, up);
+        __m256i carry = _mm256_or_si256(_mm256_or_si256
+                                        (_mm256_and_si256(right, down),
+                                         _mm256_and_si256(left, up)),
+                                        _mm256_and_si256(s1, s2));
+        __m256i dead = _mm256_andnot_si256(carry, _mm256_xor_si256(s1, s2));
+        if (_mm256_testz_si256(dead, dead))
+            continue;
+        uint64_t lanes[4];
+        _mm256_storeu_si256((__m256i *) lanes, dead);
+        for (int i = 0; i < 4; i++)
+            appendDeadEnds(deadEnds, w + i, lanes[i]);
+    }
+}
+#endif
+
+/**
+ * Fill in the dead ends of maze m and then walk what is left from the
+ * point (x,y) to the end.
+ *
+ * @param x - the starting xcord
+ * @param y - the starting ycord
+ * @param scalar - don't use the SSE2/AVX2 scans even if the cpu can
+ * @return true if a path to the end was found.
+ */
+bool solveDeadEnds(maze * m, uint x, uint y, bool scalar)
+{
+    // How far apart neighbouring cells are in m->cells, by direction
+    ptrdiff_t offset[RIGHT + 1] = { 0 };
+    offset[UP] = -(ptrdiff_t) m->stride;
+    offset[DOWN] = m->stride;
+    offset[LEFT] = -1;
+    offset[RIGHT] = 1;
+    size_t start = cellAt(m, x, y);
+    size_t dest = cellAt(m, m->destX, m->destY);
+
+    // The walls are needed again to draw the maze with --redraw
+    unsigned char *saved = NULL;
+    if (m->redraw) {
+        saved = (unsigned char *) malloc(m->cellCount / 4);
+        memcpy(saved, m->cells, m->cellCount / 4);
+    }
+
+    CellList wave = { NULL, 0, 0 };
+    CellList nextWave = { NULL, 0, 0 };
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (!scalar && __builtin_cpu_supports("avx2"))
+        findDeadEndsAVX2(m, &wave);
+    else if (!scalar && __builtin_cpu_supports("sse2"))
+        findDeadEndsSSE2(m, &wave);
+    else
+#endif
+        findDeadEnds(m, &wave);
+
+    while (wave.count > 0) {
+        for (size_t i = 0; i < wave.count; i++) {
+            size_t at = wave.cells[i];
+            int way = ways(m, at);
+            // Its last neighbour may have been filled since
+            if (at == start || at == dest || way == 0 || (way & (way - 1)))
+                continue;
+            closeWay(m, at, way);
+            size_t next = at + offset[way];
+            int left = ways(m, next);
+            if (left != 0 && (left & (left - 1)) == 0)
+                appendCell(&nextWave, next);
+        }
+        CellList done = wave;
+        wave = nextWave;
+        nextWave = done;
+        nextWave.count = 0;
+    }
+    free(wave.cells);
+    free(nextWave.cells);
+
+    bool foundEnd = solveMaze(m, x, y);
+    if (saved) {
+        memcpy(m->cells, saved, m->cellCount / 4);
+        free(saved);
+    }
+    return foundEnd;
+}
+
+/*
+ * Searching from both ends at once:
+ *
+ * One thread searches from the start and one from the end, each either
+ * depth or breadth first.  Every cell has an owner byte that a search
+ * claims with a compare and swap, holding which search got there (1 or 2)
+ * and the way it came in (index in tryOrder) above that.  When a search
+ * finds a cell the other one owns the two have met, both stop, and the
+ * path is the two chains of owners followed back from either side of the
+ * meeting.  With loops in the maze the path isn't always the shortest.
+ */
+
+// The owner byte of a search's first cell
+#define OWNERROOT 16
+// What claimCell() found
+enum CLAIM { TAKEN, CLAIMED, MET };
+
+struct Bidirectional {
+    maze *m;
+    SOLVER solver;
+    unsigned char *owners;
+    ptrdiff_t offset[4];
+    // Set by whichever search sees the other first
+    int met;
+    size_t meetFrom, meetTo;
+};
+
+struct Side {
+    Bidirectional *b;
+    // 1 from the start or 2 from the end
+    int side;
+    size_t root;
+};
+
+/**
+ * Try to make cell next part of side's search, coming from cell at by the
+ * direction tryOrder[i].
+ */
+inline CLAIM claimCell(Side * s, size_t at, size_t next, int i)
+{
+    Bidirectional *b = s->b;
+    // Only pay for the swap when the cell looks free
+    unsigned char owner = __atomic_load_n(&b->owners[next], __ATOMIC_ACQUIRE);
+    if (owner == 0
+        && __atomic_compare_exchange_n(&b->owners[next], &owner,
+                                       (unsigned char) (s->side | (i << 2)),
+                                       false, __ATOMIC_ACQ_REL,
+                                       __ATOMIC_ACQUIRE))
+        return CLAIMED;
+    if ((owner & 3) == s->side)
+        return TAKEN;
+
+    int met = 0;
+    if (__atomic_compare_exchange_n(&b->met, &met, 1, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        b->meetFrom = at;
+        b->meetTo = next;
+    }
+    return MET;
+}
+
+inline bool otherMet(Side * s)
+{
+    return __atomic_load_n(&s->b->met, __ATOMIC_RELAXED);
+}
+
+/**
+ * Depth first search for the other side, backing up with the same one
+ * byte frames as solveMaze().
+ */
+void searchDepthFirst(Side * s)
+{
+    Bidirectional *b = s->b;
+    size_t capacity = STACKBLOCK;
+    size_t depth = 0;
+    unsigned char *stack = (unsigned char *) malloc(capacity);
+    size_t at = s->root;
+
+    stack[depth++] = FRAME(0, 0);
+    while (depth > 0 && !otherMet(s)) {
+        unsigned char frame = stack[depth - 1];
+        uint tried = FRAMETRIED(frame);
+        int cell = ways(b->m, at);
+        int result = TAKEN;
+        int i = 0;
+        while (tried < 4 && result == TAKEN) {
+            i = tried++;
+            if (cell & tryOrder[i])
+                result = claimCell(s, at, at + b->offset[i], i);
+        }
+        if (result == MET)
+            break;
+        if (result == TAKEN) {
+            // Nothing left to try here, back up to the cell before
+            depth--;
+            at -= b->offset[FRAMEFROM(frame)];
+            continue;
+        }
+        stack[depth - 1] = FRAME(FRAMEFROM(frame), tried);
+
+        if (depth == capacity) {
+            capacity *= 2;
+            stack = (unsigned char *) realloc(stack, capacity);
+        }
+        stack[depth++] = FRAME(i, 0);
+        at += b->offset[i];
+    }
+    free(stack);
+}
+
+/**
+ * Breadth first search for the other side.
+ */
+void searchBreadthFirst(Side * s)
+{
+    Bidirectional *b = s->b;
+    Frontier frontier;
+    initFrontier(&frontier);
+    pushFrontier(&frontier, s->root);
+    while (frontier.count > 0 && !otherMet(s)) {
+        size_t at = popFrontier(&frontier);
+        int cell = ways(b->m, at);
+        for (int i = 0; i < 4; i++) {
+            if (!(cell & tryOrder[i]))
+                continue;
+            CLAIM result = claimCell(s, at, at + b->offset[i], i);
+            if (result == MET)
+                break;
+            if (result == CLAIMED)
+                pushFrontier(&frontier, at + b->offset[i]);
+        }
+    }
+    free(frontier.ring);
+}
+
+void *sideThread(void *arg)
+{
+    Side *s = (Side *) arg;
+    if (s->b->solver == BFS)
+        searchBreadthFirst(s);
+    else
+        searchDepthFirst(s);
+    return NULL;
+}
+
+/**
+ * Mark the cells from cell back to the first cell of whichever search
+ * owns it.
+ */
+void markOwners(Bidirectional * b, size_t cell)
+{
+    maze *m = b->m;
+    for (;;) {
+        solutionCell(m, cellX(m, cell), cellY(m, cell));
+        unsigned char owner = b->owners[cell];
+        if (owner & OWNERROOT)
+            break;
+        cell -= b->offset[owner >> 2];
+    }
+}
+
+/**
+ * Search from the point (x,y) and from the end of maze m at the same time
+ * on two threads, and mark the solution where they meet.
+ *
+ * @param x - the starting xcord
+ * @param y - the starting ycord
+ * @return true if a path to the end was found.
+ */
+bool solveBothEnds(maze * m, uint x, uint y, SOLVER solver)
+{
+    Bidirectional b;
+    b.m = m;
+    b.solver = solver;
+    b.met = 0;
+    tryOffsets(m, b.offset);
+    b.owners = (unsigned char *) calloc(m->cellCount, 1);
+
+    Side sides[2];
+    sides[0].root = cellAt(m, x, y);
+    sides[1].root = cellAt(m, m->destX, m->destY);
+    if (sides[0].root == sides[1].root) {
+        free(b.owners);
+        solutionCell(m, x, y);
+        return true;
+    }
+
+    pthread_t threads[2];
+    for (int i = 0; i < 2; i++) {
+        sides[i].b = &b;
+        sides[i].side = i + 1;
+        b.owners[sides[i].root] = sides[i].side | OWNERROOT;
+    }
+    bool threaded = (pthread_create(&threads[1], NULL, sideThread,
+                                    &sides[1]) == 0);
+    sideThread(&sides[0]);
+    if (threaded)
+        pthread_join(threads[1], NULL);
+    else
+        sideThread(&sides[1]);
+
+    if (b.met) {
+        markOwners(&b, b.meetFrom);
+        markOwners(&b, b.meetTo);
+    }
+    free(b.owners);
+    return b.met;
+}
+
+/*
+ * Solving in tiles:
+ *
+ * The maze is cut into TILESIZE square tiles.  In parallel, each tile
+ * labels which of its cells are connected to each other without leaving
+ * the tile and keeps the labels of the cells along its four edges.  Every
+ * labelled piece of every tile is then a node of a much smaller graph,
+ * joined to the pieces of the neighbouring tiles wherever a way out
+ * crosses a tile edge, and that graph is searched breadth first for the
+ * pieces from the start to the end.  Last, again in parallel, only the
+ * tiles the route goes through are searched for the path from where it
+ * enters to where it leaves them.  With loops in the maze the path isn't
+ * always the shortest.
+ */
+
+// Cells on a side of a tile
+#define TILESIZE 256
+// A cell a tile search hasn't reached
+#define NOLABEL ((uint32_t) -1)
+
+struct Tile {
+    // The cells the tile covers
+    uint x0, y0, width, height;
+    // The label of each cell along the top, bottom, left and right edges
+    uint32_t *top, *bottom, *left, *right;
+    uint32_t pieces;
+    // Node of the stitched graph for piece 0
+    size_t firstNode;
+};
+
+/**
+ * A way out crossing from cell from of piece node to cell to of piece other
+ * in the next tile.
+ */
+struct Crossing {
+    size_t node, other;
+    size_t from, to;
+};
+
+/**
+ * The part of the path inside one tile.
+ */
+struct Segment {
+    uint tile;
+    size_t from, to;
+    CellList cells;
+};
+
+struct TileWork {
+    maze *m;
+    Tile *tiles;
+    uint tilesAcross, tileCount;
+    Segment *segments;
+    uint segmentCount;
+    // Next tile or segment to take, shared by the threads
+    uint next;
+    // The start and the end, and their pieces set by whichever thread
+    // labels their tiles
+    size_t start, dest;
+    size_t startTile, destTile;
+    uint32_t startPiece, destPiece;
+};
+
+/**
+ * Scratch space for searching one tile.
+ */
+struct TileScratch {
+    uint32_t *label;
+    uint32_t *queue;
+};
+
+/**
+ * @return which tile of w holds cell
+ */
+inline uint tileOf(TileWork * w, size_t cell)
+{
+    return (cellY(w->m, cell) / TILESIZE) * w->tilesAcross
+        + cellX(w->m, cell) / TILESIZE;
+}
+
+/**
+ * Flood tile t of maze m out from the cell numbered first in the tile,
+ * never leaving the tile, giving every cell reached label (or for
+ * searchTile() the way it was entered).
+ * @return how many cells were reached
+ */
+uint floodTile(maze * m, Tile * t, TileScratch * s, uint first,
+               uint32_t label, bool directions)
+{
+    uint head = 0, tail = 0;
+    s->label[first] = directions ? 4 : label;
+    s->queue[tail++] = first;
+    while (head < tail) {
+        uint at = s->queue[head++];
+        uint x = at % t->width, y = at / t->width;
+        int cell = ways(m, cellAt(m, t->x0 + x, t->y0 + y));
+        for (int i = 0; i < 4; i++) {
+            int dir = tryOrder[i];
+            if (!(cell & dir))
+                continue;
+            uint next;
+            switch (dir) {
+            case UP:
+                if (y == 0) continue;
+                next = at - t->width; break;
+            case DOWN:
+                if (y + 1 == t->height) continue;
+                next = at + t->width; break;
+            case LEFT:
+                if (x == 0) continue;
+                next = at - 1; break;
+            default:
+                if (x + 1 == t->width) continue;
+                next = at + 1; break;
+            }
+            if (s->label[next] != NOLABEL)
+                continue;
+            s->label[next] = directions ? i : label;
+            s->queue[tail++] = next;
+        }
+    }
+    return tail;
+}
+
+/**
+ * Label the pieces of tile number i and keep the labels along its edges.
+ */
+void labelTile(TileWork * w, uint i, TileScratch * s)
+{
+    maze *m = w->m;
+    Tile *t = &w->tiles[i];
+    uint size = t->width * t->height;
+    memset(s->label, 0xff, size * sizeof(uint32_t));
+    t->pieces = 0;
+    for (uint at = 0; at < size; at++)
+        if (s->label[at] == NOLABEL)
+            floodTile(m, t, s, at, t->pieces++, false);
+
+    for (uint x = 0; x < t->width; x++) {
+        t->top[x] = s->label[x];
+        t->bottom[x] = s->label[(t->height - 1) * t->width + x];
+    }
+    for (uint y = 0; y < t->height; y++) {
+        t->left[y] = s->label[y * t->width];
+        t->right[y] = s->label[y * t->width + t->width - 1];
+    }
+
+    // Only one tile holds each of these
+    if (w->startTile == i)
+        w->startPiece = s->label[(cellY(m, w->start) - t->y0) * t->width
+                                 + cellX(m, w->start) - t->x0];
+    if (w->destTile == i)
+        w->destPiece = s->label[(cellY(m, w->dest) - t->y0) * t->width
+                                + cellX(m, w->dest) - t->x0];
+}
+
+/**
+ * Find the path across segment number i from where it enters its tile to
+ * where it leaves.
+ */
+void searchTile(TileWork * w, uint i, TileScratch * s)
+{
+    maze *m = w->m;
+    Segment *g = &w->segments[i];
+    Tile *t = &w->tiles[g->tile];
+    uint size = t->width * t->height;
+    memset(s->label, 0xff, size * sizeof(uint32_t));
+    uint from = (cellY(m, g->from) - t->y0) * t->width
+        + cellX(m, g->from) - t->x0;
+    floodTile(m, t, s, from, 0, true);
+
+    // Walk back from where it leaves by the way each cell was entered
+    size_t cell = g->to;
+    uint at = (cellY(m, cell) - t->y0) * t->width + cellX(m, cell) - t->x0;
+    while (s->label[at] < 4) {
+        appendCell(&g->cells, cell);
+        switch (tryOrder[s->label[at]]) {
+        case UP:    at += t->width; cell += m->stride; break;
+        case DOWN:  at -= t->width; cell -= m->stride; break;
+        case LEFT:  at += 1; cell += 1; break;
+        case RIGHT: at -= 1; cell -= 1; break;
+        }
+    }
+    appendCell(&g->cells, cell);
+}
+
+/**
+ * Work through the tiles (while labelling) or segments (once the route is
+ * known) until there are none left.
+ */
+void *tileThread(void *arg)
+{
+    TileWork *w = (TileWork *) arg;
+    TileScratch s;
+    s.label = (uint32_t *) malloc(TILESIZE * TILESIZE * sizeof(uint32_t));
+    s.queue = (uint32_t *) malloc(TILESIZE * TILESIZE * sizeof(uint32_t));
+    bool labelling = (w->segments == NULL);
+    uint count = labelling ? w->tileCount : w->segmentCount;
+    for (;;) {
+        uint i = __atomic_fetch_add(&w->next, 1, __ATOMIC_RELAXED);
+        if (i >= count)
+            break;
+        if (labelling)
+            labelTile(w, i, &s);
+        else
+            searchTile(w, i, &s);
+    }
+    free(s.label);
+    free(s.queue);
+    return NULL;
+}
+
+/**
+ * Run tileThread() on threadCount threads (this one being one of them),
+ * or one for each tile or segment if there are fewer.
+ */
+void runTileThreads(TileWork * w, uint threadCount)
+{
+    w->next = 0;
+    uint count = w->segments == NULL ? w->tileCount : w->segmentCount;
+    if (threadCount > count)
+        threadCount = count > 0 ? count : 1;
+    pthread_t *threads = new pthread_t[threadCount];
+    uint started = 0;
+    for (uint i = 1; i < threadCount; i++)
+        if (pthread_create(&threads[started], NULL, tileThread, w) == 0)
+            started++;
+    tileThread(w);
+    for (uint i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    delete[]threads;
+}
+
+/**
+ * Add the crossings between piece a of one tile and piece b of the next
+ * through cells from and to, both ways, to edges.
+ */
+void addCrossing(Crossing ** edges, size_t * count, size_t * capacity,
+                 size_t a, size_t from, size_t b, size_t to)
+{
+    if (*count + 2 > *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 1024;
+        *edges = (Crossing *) realloc(*edges, *capacity * sizeof(Crossing));
+    }
+    Crossing c1 = { a, b, from, to };
+    Crossing c2 = { b, a, to, from };
+    (*edges)[(*count)++] = c1;
+    (*edges)[(*count)++] = c2;
+}
+
+/**
+ * Solve maze m in tiles on threadCount threads from the point (x,y).
+ *
+ * @param x - the starting xcord
+ * @param y - the starting ycord
+ * @return true if a path to the end was found.
+ */
+bool solveTiles(maze * m, uint x, uint y, uint threadCount)
+{
+    TileWork w;
+    w.m = m;
+    w.tilesAcross = (m->width + TILESIZE - 1) / TILESIZE;
+    uint tilesDown = (m->height + TILESIZE) / TILESIZE;
+    w.tileCount = w.tilesAcross * tilesDown;
+    w.tiles = new Tile[w.tileCount];
+    w.segments = NULL;
+    w.segmentCount = 0;
+    w.startPiece = w.destPiece = 0;
+    uint32_t *edgeLabels = new uint32_t[(size_t) w.tileCount * TILESIZE * 4];
+    for (uint i = 0; i < w.tileCount; i++) {
+        Tile *t = &w.tiles[i];
+        t->x0 = (i % w.tilesAcross) * TILESIZE;
+        t->y0 = (i / w.tilesAcross) * TILESIZE;
+        t->width = m->width - t->x0 < TILESIZE ? m->width - t->x0 : TILESIZE;
+        t->height = m->height + 1 - t->y0 < TILESIZE
+            ? m->height + 1 - t->y0 : TILESIZE;
+        t->top = edgeLabels + (size_t) i * TILESIZE * 4;
+        t->bottom = t->top + TILESIZE;
+        t->left = t->bottom + TILESIZE;
+        t->right = t->left + TILESIZE;
+    }
+    size_t start = w.start = cellAt(m, x, y);
+    size_t dest = w.dest = cellAt(m, m->destX, m->destY);
+    w.startTile = tileOf(&w, start);
+    w.destTile = tileOf(&w, dest);
+    runTileThreads(&w, threadCount);
+
+    // Number the pieces and join them where the ways cross tile edges
+    size_t nodeCount = 0;
+    for (uint i = 0; i < w.tileCount; i++) {
+        w.tiles[i].firstNode = nodeCount;
+        nodeCount += w.tiles[i].pieces;
+    }
+    Crossing *edges = NULL;
+    size_t edgeCount = 0, edgeCapacity = 0;
+    for (uint i = 0; i < w.tileCount; i++) {
+        Tile *t = &w.tiles[i];
+        if (t->x0 + t->width < m->width) {
+            Tile *r = &w.tiles[i + 1];
+            for (uint j = 0; j < t->height; j++) {
+                size_t from = cellAt(m, t->x0 + t->width - 1, t->y0 + j);
+                if (ways(m, from) & RIGHT)
+                    addCrossing(&edges, &edgeCount, &edgeCapacity,
+                                t->firstNode + t->right[j], from,
+                                r->firstNode + r->left[j], from + 1);
+            }
+        }
+        if (t->y0 + t->height <= m->height) {
+            Tile *d = &w.tiles[i + w.tilesAcross];
+            for (uint j = 0; j < t->width; j++) {
+                size_t from = cellAt(m, t->x0 + j, t->y0 + t->height - 1);
+                if (ways(m, from) & DOWN)
+                    addCrossing(&edges, &edgeCount, &edgeCapacity,
+                                t->firstNode + t->bottom[j], from,
+                                d->firstNode + d->top[j], from + m->stride);
+            }
+        }
+    }
+
+    // Each node's crossings together
+    size_t *firstEdge = (size_t *) calloc(nodeCount + 1, sizeof(size_t));
+    for (size_t e = 0; e < edgeCount; e++)
+        firstEdge[edges[e].node + 1]++;
+    for (size_t n = 0; n < nodeCount; n++)
+        firstEdge[n + 1] += firstEdge[n];
+    size_t *fill = (size_t *) malloc((nodeCount + 1) * sizeof(size_t));
+    memcpy(fill, firstEdge, (nodeCount + 1) * sizeof(size_t));
+    Crossing *byNode = (Crossing *) malloc((edgeCount + 1) * sizeof(Crossing));
+    for (size_t e = 0; e < edgeCount; e++)
+        byNode[fill[edges[e].node]++] = edges[e];
+    free(fill);
+    free(edges);
+
+    // Breadth first through the pieces, keeping the crossing into each
+    size_t startNode = w.tiles[w.startTile].firstNode + w.startPiece;
+    size_t destNode = w.tiles[w.destTile].firstNode + w.destPiece;
+    size_t *entered = (size_t *) malloc(nodeCount * sizeof(size_t));
+    memset(entered, 0xff, nodeCount * sizeof(size_t));
+    size_t *queue = (size_t *) malloc(nodeCount * sizeof(size_t));
+    size_t head = 0, tail = 0;
+    entered[startNode] = edgeCount;
+    queue[tail++] = startNode;
+    while (head < tail && entered[destNode] == (size_t) -1) {
+        size_t node = queue[head++];
+        for (size_t e = firstEdge[node]; e < firstEdge[node + 1]; e++) {
+            size_t next = byNode[e].other;
+            if (entered[next] != (size_t) -1)
+                continue;
+            entered[next] = e;
+            queue[tail++] = next;
+        }
+    }
+    free(queue);
+    bool foundEnd = (entered[destNode] != (size_t) -1);
+
+    if (foundEnd) {
+        // Count the crossings back from the end, one segment more
+        uint crossings = 0;
+        for (size_t n = destNode; n != startNode; crossings++)
+            n = byNode[entered[n]].node;
+        w.segmentCount = crossings + 1;
+        w.segments = new Segment[w.segmentCount];
+        size_t to = dest;
+        size_t n = destNode;
+        for (uint s = w.segmentCount; s-- > 0;) {
+            Segment *g = &w.segments[s];
+            g->to = to;
+            g->cells.cells = NULL;
+            g->cells.count = g->cells.capacity = 0;
+            if (s == 0) {
+                g->from = start;
+            } else {
+                Crossing *c = &byNode[entered[n]];
+                g->from = c->to;
+                to = c->from;
+                n = c->node;
+            }
+            g->tile = tileOf(&w, g->from);
+        }
+        runTileThreads(&w, threadCount);
+        for (uint s = 0; s < w.segmentCount; s++) {
+            CellList *cells = &w.segments[s].cells;
+            for (size_t i = 0; i < cells->count; i++)
+                solutionCell(m, cellX(m, cells->cells[i]),
+                             cellY(m, cells->cells[i]));
+            free(cells->cells);
+        }
+        delete[]w.segments;
+    }
+
+    free(entered);
+    free(byNode);
+    free(firstEdge);
+    delete[]edgeLabels;
+    delete[]w.tiles;
+    return foundEnd;
+}
+
+/*
+ * Writing just the path:
+ *
+ * The solvers only mark which cells are on the path, so the marked cells
+ * are walked from the start to the end again (backing up like solveMaze()
+ * if they ever touch) to get the moves in order.
+ */
+
+// What to write out once the maze is solved
+enum OUTPUT { MAZE, COORDINATES, MOVES, PACKEDPATH };
+
+/**
+ * Follow the cells marked as the solution of maze m from the start to the
+ * end, unmarking them along the way.
+ * @param count - set to the number of moves
+ * @return the moves as UP, DOWN, LEFT or RIGHT (to be freed) or NULL if
+ * the marked cells don't reach the end
+ */
+unsigned char *tracePath(maze * m, size_t * count)
+{
+    ptrdiff_t offset[RIGHT + 1] = { 0 };
+    offset[UP] = -(ptrdiff_t) m->stride;
+    offset[DOWN] = m->stride;
+    offset[LEFT] = -1;
+    offset[RIGHT] = 1;
+
+    size_t capacity = STACKBLOCK;
+    size_t depth = 0;
+    unsigned char *stack = (unsigned char *) malloc(capacity);
+    size_t at = cellAt(m, m->startX, m->startY);
+    size_t dest = cellAt(m, m->destX, m->destY);
+
+    m->solution[at / 8] &= ~(1 << (at % 8));
+    stack[depth++] = FRAME(EMPTY, 0);
+    while (depth > 0 && at != dest) {
+        unsigned char frame = stack[depth - 1];
+        uint tried = FRAMETRIED(frame);
+        int cell = ways(m, at);
+        int dir = EMPTY;
+        while (tried < 4) {
+            int way = tryOrder[tried++];
+            if ((cell & way) && onPath(m, at + offset[way])) {
+                dir = way;
+                break;
+            }
+        }
+        if (dir == EMPTY) {
+            depth--;
+            at -= offset[FRAMEFROM(frame)];
+            continue;
+        }
+        stack[depth - 1] = FRAME(FRAMEFROM(frame), tried);
+        at += offset[dir];
+        m->solution[at / 8] &= ~(1 << (at % 8));
+        if (depth == capacity) {
+            capacity *= 2;
+            stack = (unsigned char *) realloc(stack, capacity);
+        }
+        stack[depth++] = FRAME(dir, 0);
+    }
+    if (depth == 0) {
+        free(stack);
+        return NULL;
+    }
+
+    // Each frame past the first came in by the next move
+    *count = depth - 1;
+    for (size_t i = 0; i < *count; i++)
+        stack[i] = FRAMEFROM(stack[i + 1]);
+    return stack;
+}
+
+/**
+ * Write count moves to out as each run of the same move, the letter and
+ * how many (U3 R12 D1).
+ */
+void writeMoves(const unsigned char *moves, size_t count, FILE * out)
+{
+    for (size_t i = 0; i < count;) {
+        size_t run = 1;
+        while (i + run < count && moves[i + run] == moves[i])
+            run++;
+        char letter = 'U';
+        switch (moves[i]) {
+        case DOWN:  letter = 'D'; break;
+        case LEFT:  letter = 'L'; break;
+        case RIGHT: letter = 'R'; break;
+        }
+        fprintf(out, (i == 0) ? "%c%lu" : " %c%lu", letter,
+                (unsigned long) run);
+        i += run;
+    }
+}
+
+/**
+ * Write the solution of maze m to out in the form output.
+ * @return false if the path couldn't be followed
+ */
+bool writePath(maze * m, OUTPUT output, FILE * out)
+{
+    size_t count = 0;
+    unsigned char *moves = tracePath(m, &count);
+    if (moves == NULL) {
+        fprintf(stderr, "The marked path doesn't reach the end.\n");
+        return false;
+    }
+
+    uint x = m->startX, y = m->startY;
+    if (output == COORDINATES) {
+        fprintf(out, "(%u,%u)\n", x, y);
+        for (size_t i = 0; i < count; i++) {
+            step(moves[i], x, y);
+            fprintf(out, "(%u,%u)\n", x, y);
+        }
+    } else if (output == MOVES) {
+        writeMoves(moves, count, out);
+        fputc('\n', out);
+    } else {
+        unsigned char header[MAZEPATH_HEADERSIZE];
+        mazePathWriteHeader(header, x, y, count);
+        fwrite(header, 1, MAZEPATH_HEADERSIZE, out);
+        // Pack the moves over the front of the array they came from
+        size_t bytes = (count + 3) / 4;
+        for (size_t i = 0; i < bytes; i++) {
+            unsigned char packed = 0;
+            for (size_t j = 0; j < 4 && i * 4 + j < count; j++) {
+                uint move = MAZEPATH_UP;
+                switch (moves[i * 4 + j]) {
+                case DOWN:  move = MAZEPATH_DOWN; break;
+                case LEFT:  move = MAZEPATH_LEFT; break;
+                case RIGHT: move = MAZEPATH_RIGHT; break;
+                }
+                packed |= move << (j * 2);
+            }
+            moves[i] = packed;
+        }
+        fwrite(moves, 1, bytes, out);
+    }
+    free(moves);
+    return true;
+}
+
+/**
+ * How to solve and write out each maze, from the command line.
+ */
+struct Settings {
+    SOLVER solver;
+    bool bothEnds;
+    bool scalar;
+    bool redraw;
+    uint threadCount;
+    OUTPUT output;
+};
+
+/**
+ * Set up maze m with nothing in it yet.
+ */
+void initMaze(maze * m, bool redraw)
+{
+    m->width = m->height = 0;
+    m->text = NULL;
+    m->textShared = false;
+    m->lines = NULL;
+    m->lineCapacity = 0;
+    m->cells = NULL;
+    m->visited = NULL;
+    m->solution = NULL;
+    m->cellCapacity = 0;
+    m->marks.cells = NULL;
+    m->marks.count = m->marks.capacity = 0;
+    m->redraw = redraw;
+    m->expanded = 0;
+}
+
+/**
+ * Release everything maze m holds.
+ */
+void freeMaze(maze * m)
+{
+    free(m->cells);
+    free(m->visited);
+    free(m->solution);
+    free(m->marks.cells);
+    freeText(m);
+    delete[]m->lines;
+}
+
+/**
+ * Solve maze m with the solver settings asks for.
+ * @return true if a path to the end was found.
+ */
+bool solve(maze * m, Settings * settings)
+{
+    if (settings->bothEnds)
+        return solveBothEnds(m, m->startX, m->startY, settings->solver);
+    switch (settings->solver) {
+    case BFS:
+        return solveBreadthFirst(m, m->startX, m->startY);
+    case ASTAR:
+        return solveAStar(m, m->startX, m->startY);
+    case FILL:
+        return solveDeadEnds(m, m->startX, m->startY, settings->scalar);
+    case TILES:
+        return solveTiles(m, m->startX, m->startY, settings->threadCount);
+    default:
+        return solveMaze(m, m->startX, m->startY);
+    }
+}
+
+/**
+ * Write solved maze m to out the way settings asks for.
+ * @return false if the path couldn't be written
+ */
+bool writeSolved(maze * m, Settings * settings, FILE * out)
+{
+    if (settings->output != MAZE)
+        return writePath(m, settings->output, out);
+    write(m, out);
+    return true;
+}
+
+/*
+ * Solving a batch of mazes:
+ *
+ * With --batch the mazes come from the files named on the command line
+ * (every file of a directory, in name order) or one after another on
+ * stdin with a line starting with a form feed between them.  Packed mazes
+ * know their own size and don't need the line.  Threads take the next maze
+ * off the list as they finish the last, each with one maze whose cells,
+ * lines and marks are used again for every maze it solves.  Each result is
+ * kept until the ones before it are written so that they come out in the
+ * order the mazes went in, with the same line between them.
+ */
+
+// Starts the line between two mazes of a --batch stream
+#define SEPARATOR '\f'
+#define JOBBLOCK 256
+
+struct BatchJob {
+    // The file the maze is in, or where it is in the stream
+    char *name;
+    const char *data;
+    size_t size;
+    // What to write out for it
+    char *result;
+    size_t resultSize;
+    bool done;
+};
+
+struct Batch {
+    Settings settings;
+    BatchJob *jobs;
+    uint jobCount, jobCapacity;
+    // Next job to take, shared by the threads
+    uint next;
+    // Guards the rest.  Whoever finishes the next job to be written writes
+    // it and every finished one after it, outside the lock, while the
+    // others only mark theirs done.
+    pthread_mutex_t lock;
+    uint written;
+    bool writing;
+    bool failed;
+};
+
+/**
+ * Add the maze in file name (or data if there is none) to b.
+ */
+void addJob(Batch * b, char *name, const char *data, size_t size)
+{
+    if (b->jobCount == b->jobCapacity) {
+        b->jobCapacity = b->jobCapacity ? b->jobCapacity * 2 : JOBBLOCK;
+        b->jobs = (BatchJob *) realloc(b->jobs,
+                                       b->jobCapacity * sizeof(BatchJob));
+    }
+    BatchJob *job = &b->jobs[b->jobCount++];
+    job->name = name;
+    job->data = data;
+    job->size = size;
+    job->result = NULL;
+    job->resultSize = 0;
+    job->done = false;
+}
+
+/**
+ * Sort file names from lowest to highest.
+ */
+int compareNames(const void *a, const void *b)
+{
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/**
+ * Add every file in directory path to b in name order.
+ * @return false if the directory couldn't be read
+ */
+bool addDirectory(Batch * b, const char *path)
+{
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        perror(path);
+        return false;
+    }
+    uint first = b->jobCount;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+        char *name = (char *) malloc(strlen(path) + strlen(entry->d_name) + 2);
+        sprintf(name, "%s/%s", path, entry->d_name);
+        struct stat st;
+        if (stat(name, &st) != 0 || !S_ISREG(st.st_mode)) {
+            free(name);
+            continue;
+        }
+        addJob(b, name, NULL, 0);
+    }
+    closedir(dir);
+    // The names are first in each job
+    char **names = new char *[b->jobCount - first];
+    for (uint i = first; i < b->jobCount; i++)
+        names[i - first] = b->jobs[i].name;
+    qsort(names, b->jobCount - first, sizeof(char *), compareNames);
+    for (uint i = first; i < b->jobCount; i++)
+        b->jobs[i].name = names[i - first];
+    delete[]names;
+    return true;
+}
+
+/**
+ * @return the start of the line after the one p is on
+ */
+inline const char *nextLine(const char *p, const char *end)
+{
+    p = (const char *) memchr(p, '\n', end - p);
+    return (p == NULL) ? end : p + 1;
+}
+
+/**
+ * Split the stream of mazes in data into jobs for b.
+ */
+void splitStream(Batch * b, const char *data, size_t size)
+{
+    const char *end = data + size;
+    const char *p = data;
+    while (p < end) {
+        const char *next = p;
+        MazeFileHeader h;
+        if ((size_t) (end - p) >= MAZEFILE_HEADERSIZE
+            && mazeFileReadHeader((const unsigned char *) p, &h)) {
+            size_t packed = mazeFileSize(&h);
+            next = (packed < (size_t) (end - p)) ? p + packed : end;
+        } else {
+            while (next < end && *next != SEPARATOR)
+                next = nextLine(next, end);
+        }
+        // Leave out what is only blank lines
+        const char *q = p;
+        while (q < next && (*q == '\n' || *q == '\r'))
+            q++;
+        if (q < next)
+            addJob(b, NULL, p, next - p);
+        if (next < end && *next == SEPARATOR)
+            next = nextLine(next, end);
+        p = next;
+    }
+}
+
+/**
+ * Say on stderr that job i of b went wrong and how.
+ */
+void jobError(Batch * b, uint i, const char *what)
+{
+    if (b->jobs[i].name)
+        fprintf(stderr, "%s: %s\n", b->jobs[i].name, what);
+    else
+        fprintf(stderr, "Maze %u of the batch: %s\n", i + 1, what);
+}
+
+/**
+ * Read, solve and write out job i of b into its result using maze m.
+ * @return false if the maze couldn't be solved
+ */
+bool runJob(Batch * b, uint i, maze * m)
+{
+    BatchJob *job = &b->jobs[i];
+    m->width = m->height = 0;
+    m->marks.count = 0;
+    bool ok = true;
+    if (job->name == NULL) {
+        m->text = (char *) job->data;
+        m->textSize = job->size;
+        m->textMapped = false;
+        m->textShared = true;
+    } else {
+        int fd = open(job->name, O_RDONLY);
+        ok = (fd >= 0 && readInput(m, fd));
+        if (fd >= 0)
+            close(fd);
+    }
+
+    FILE *out = open_memstream(&job->result, &job->resultSize);
+    if (!ok || !parse(m)) {
+        jobError(b, i, "couldn't be read.");
+        ok = false;
+    } else if (!solve(m, &b->settings)) {
+        jobError(b, i, "no path found through maze.");
+        ok = false;
+    } else {
+        ok = writeSolved(m, &b->settings, out);
+    }
+    if (b->settings.output != PACKEDPATH && i + 1 < b->jobCount)
+        fprintf(out, "%c\n", SEPARATOR);
+    fclose(out);
+    freeText(m);
+    return ok;
+}
+
+/**
+ * Mark job i of b done and write out every result that is next in order.
+ */
+void finishJob(Batch * b, uint i, bool ok)
+{
+    pthread_mutex_lock(&b->lock);
+    b->jobs[i].done = true;
+    if (!ok)
+        b->failed = true;
+    if (b->writing) {
+        pthread_mutex_unlock(&b->lock);
+        return;
+    }
+    b->writing = true;
+    while (b->written < b->jobCount && b->jobs[b->written].done) {
+        BatchJob *job = &b->jobs[b->written];
+        pthread_mutex_unlock(&b->lock);
+        bool wrote = (fwrite(job->result, 1, job->resultSize, stdout)
+                      == job->resultSize);
+        free(job->result);
+        job->result = NULL;
+        pthread_mutex_lock(&b->lock);
+        b->written++;
+        if (!wrote)
+            b->failed = true;
+    }
+    b->writing = false;
+    pthread_mutex_unlock(&b->lock);
+}
+
+/**
+ * Solve jobs of b until there are none left.
+ */
+void *batchThread(void *arg)
+{
+    Batch *b = (Batch *) arg;
+    maze m;
+    initMaze(&m, b->settings.redraw);
+    for (;;) {
+        uint i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED);
+        if (i >= b->jobCount)
+            break;
+        finishJob(b, i, runJob(b, i, &m));
+    }
+    freeMaze(&m);
+    return NULL;
+}
+
+/**
+ * Solve every maze in the files and directories paths, or in the stream
+ * on stdin if there are none, and write them out in order.
+ * @return true if every maze was solved.
+ */
+bool solveBatch(Settings * settings, char **paths, int pathCount)
+{
+    Batch b;
+    b.settings = *settings;
+    // The threads are already spread over the mazes
+    b.settings.threadCount = 1;
+    b.jobs = NULL;
+    b.jobCount = b.jobCapacity = 0;
+    b.next = 0;
+    b.written = 0;
+    b.writing = false;
+    b.failed = false;
+    pthread_mutex_init(&b.lock, NULL);
+
+    maze input;
+    initMaze(&input, false);
+    if (pathCount == 0 && readInput(&input, STDIN_FILENO))
+        splitStream(&b, input.text, input.textSize);
+    for (int i = 0; i < pathCount; i++) {
+        struct stat st;
+        if (stat(paths[i], &st) != 0) {
+            perror(paths[i]);
+            b.failed = true;
+        } else if (S_ISDIR(st.st_mode)) {
+            b.failed |= !addDirectory(&b, paths[i]);
+        } else {
+            addJob(&b, strdup(paths[i]), NULL, 0);
+        }
+    }
+    if (b.jobCount == 0)
+        fprintf(stderr, "No mazes to solve.\n");
+
+    uint threadCount = settings->threadCount < b.jobCount
+        ? settings->threadCount : b.jobCount;
+    pthread_t *threads = new pthread_t[threadCount + 1];
+    uint started = 0;
+    for (uint i = 1; i < threadCount; i++)
+        if (pthread_create(&threads[started], NULL, batchThread, &b) == 0)
+            started++;
+    batchThread(&b);
+    for (uint i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    delete[]threads;
+    if (fflush(stdout) != 0 || ferror(stdout)) {
+        fprintf(stderr, "Couldn't write the mazes out.\n");
+        b.failed = true;
+    }
+
+    for (uint i = 0; i < b.jobCount; i++)
+        free(b.jobs[i].name);
+    free(b.jobs);
+    freeText(&input);
+    pthread_mutex_destroy(&b.lock);
+    return !b.failed && b.jobCount > 0;
+}
+
+/*
+ * Serving mazes:
+ *
+ * With --serve the mazes come over a Unix socket, so a caller that solves
+ * one maze at a time doesn't pay to start a process for each.  Each
+ * request is a 4 byte little endian length followed by that many bytes of
+ * maze, ASCII or packed (see mazefile.h) just like stdin.  Each answer is
+ * a 4 byte status (SOLVED, UNREADABLE, NOPATH or FAILED if the answer
+ * couldn't be written), a 4 byte length and that many bytes of what would
+ * have been written to stdout.  A
+ * connection is served by its own thread and can send any number of
+ * requests, its request and answer buffers and its maze are kept from one
+ * to the next.  A request over --max-request megabytes closes the
+ * connection, and past --connections at once the rest wait to be
+ * accepted.
+ *
+ * Parsed grids are kept in a cache shared by the connections, looked up by
+ * a hash of the request, and the least recently used are dropped once
+ * they take up more than --cache megabytes.  A maze sent again is copied
+ * out of the cache instead of being parsed.
+ */
+
+// The status of an answer
+enum ANSWER { SOLVED, UNREADABLE, NOPATH, FAILED };
+
+#define CACHEBUCKETS 4096
+
+/**
+ * Bytes that grow as needed and are used again.
+ */
+struct Buffer {
+    char *data;
+    size_t size, capacity;
+};
+
+/**
+ * Make room for size bytes in b.
+ * @return false if there isn't enough memory
+ */
+bool reserve(Buffer * b, size_t size)
+{
+    if (size <= b->capacity)
+        return true;
+    size_t capacity = b->capacity ? b->capacity : INPUTBLOCK;
+    while (capacity < size)
+        capacity *= 2;
+    char *bigger = (char *) realloc(b->data, capacity);
+    if (bigger == NULL)
+        return false;
+    b->data = bigger;
+    b->capacity = capacity;
+    return true;
+}
+
+/**
+ * fopencookie() write function adding to a Buffer.
+ */
+ssize_t writeBuffer(void *cookie, const char *data, size_t size)
+{
+    Buffer *b = (Buffer *) cookie;
+    if (!reserve(b, b->size + size))
+        return -1;
+    memcpy(b->data + b->size, data, size);
+    b->size += size;
+    return size;
+}
+
+/**
+ * A parsed grid kept in the cache.
+ */
+struct CachedGrid {
+    // The request it was parsed from
+    uint64_t hash;
+    char *request;
+    size_t requestSize;
+    // What parse() filled in, lines as offsets into the request (ASCII
+    // mazes only)
+    unsigned char *cells;
+    size_t cellCount;
+    uint width, height;
+    uint startX, startY, destX, destY;
+    size_t *lines;
+    uint lineCount;
+    size_t bytes;
+    CachedGrid *newer, *older;
+    CachedGrid *nextInBucket;
+    // Lookups copying out of it with the lock let go, and whether it was
+    // dropped meanwhile and is freed by the last of them
+    uint users;
+    bool dropped;
+};
+
+struct GridCache {
+    pthread_mutex_t lock;
+    CachedGrid *buckets[CACHEBUCKETS];
+    CachedGrid *newest, *oldest;
+    size_t bytes, limit;
+};
+
+/**
+ * @return a hash of the size bytes at data, taken a word at a time
+ */
+uint64_t hashBytes(const char *data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ULL ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 1099511628211ULL;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; i++)
+        hash = (hash ^ (unsigned char) data[i]) * 1099511628211ULL;
+    return hash;
+}
+
+/**
+ * Take grid g out of the recently used list of cache c.
+ */
+void unlinkGrid(GridCache * c, CachedGrid * g)
+{
+    if (g->newer)
+        g->newer->older = g->older;
+    else
+        c->newest = g->older;
+    if (g->older)
+        g->older->newer = g->newer;
+    else
+        c->oldest = g->newer;
+}
+
+/**
+ * Put grid g at the front of the recently used list of cache c.
+ */
+void linkGrid(GridCache * c, CachedGrid * g)
+{
+    g->newer = NULL;
+    g->older = c->newest;
+    if (c->newest)
+        c->newest->newer = g;
+    c->newest = g;
+    if (c->oldest == NULL)
+        c->oldest = g;
+}
+
+/**
+ * Free grid g once it is out of the cache.
+ */
+void freeGrid(CachedGrid * g)
+{
+    free(g->request);
+    free(g->cells);
+    free(g->lines);
+    delete g;
+}
+
+/**
+ * Drop the least recently used grid of cache c.  A grid still being copied
+ * out of is left for the lookup to free.
+ */
+void dropOldest(GridCache * c)
+{
+    CachedGrid *g = c->oldest;
+    unlinkGrid(c, g);
+    CachedGrid **p = &c->buckets[g->hash % CACHEBUCKETS];
+    while (*p != g)
+        p = &(*p)->nextInBucket;
+    *p = g->nextInBucket;
+    c->bytes -= g->bytes;
+    if (g->users > 0)
+        g->dropped = true;
+    else
+        freeGrid(g);
+}
+
+/**
+ * Copy cached grid g into maze m, which has room for its cells.
+ */
+void copyGrid(CachedGrid * g, maze * m)
+{
+    memcpy(m->cells, g->cells, g->cellCount / 4);
+    m->width = g->width;
+    m->height = g->height;
+    m->startX = g->startX;
+    m->startY = g->startY;
+    m->destX = g->destX;
+    m->destY = g->destY;
+    if (g->lines) {
+        if (g->lineCount + 1 > m->lineCapacity) {
+            delete[]m->lines;
+            m->lines = new char *[g->lineCount + 1];
+            m->lineCapacity = g->lineCount + 1;
+        }
+        m->lineCount = g->lineCount;
+        for (uint i = 0; i <= g->lineCount; i++)
+            m->lines[i] = m->text + g->lines[i];
+    }
+}
+
+/**
+ * Fill maze m from the grid cached for request (with hash) if there is
+ * one, using request as the text of an ASCII maze.  Only finding the grid
+ * is done holding the lock; it is kept from being freed while it is
+ * compared and copied so other connections aren't held up.
+ * @return false if it isn't cached
+ */
+bool lookUpGrid(GridCache * c, maze * m, uint64_t hash,
+                const char *request, size_t size)
+{
+    pthread_mutex_lock(&c->lock);
+    CachedGrid *g = c->buckets[hash % CACHEBUCKETS];
+    while (g && (g->hash != hash || g->requestSize != size))
+        g = g->nextInBucket;
+    if (g == NULL) {
+        pthread_mutex_unlock(&c->lock);
+        return false;
+    }
+    g->users++;
+    pthread_mutex_unlock(&c->lock);
+
+    bool found = (memcmp(g->request, request, size) == 0
+                  && allocateCells(m, g->width, g->height + 1));
+    if (found)
+        copyGrid(g, m);
+
+    pthread_mutex_lock(&c->lock);
+    g->users--;
+    if (g->dropped) {
+        if (g->users == 0)
+            freeGrid(g);
+    } else if (found) {
+        unlinkGrid(c, g);
+        linkGrid(c, g);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return found;
+}
+
+/**
+ * Keep the grid just parsed into maze m from request (with hash) in the
+ * cache, dropping old ones to make room.
+ */
+void cacheGrid(GridCache * c, maze * m, uint64_t hash,
+               const char *request, size_t size)
+{
+    bool hasLines = (m->text == request);
+    size_t bytes = size + m->cellCount / 4
+        + (hasLines ? (m->lineCount + 1) * sizeof(size_t) : 0);
+    if (bytes > c->limit)
+        return;
+    CachedGrid *g = new CachedGrid;
+    g->hash = hash;
+    g->request = (char *) malloc(size);
+    g->cells = (unsigned char *) malloc(m->cellCount / 4);
+    g->lines = hasLines
+        ? (size_t *) malloc((m->lineCount + 1) * sizeof(size_t)) : NULL;
+    if (g->request == NULL || g->cells == NULL
+        || (hasLines && g->lines == NULL)) {
+        free(g->request);
+        free(g->cells);
+        free(g->lines);
+        delete g;
+        return;
+    }
+    memcpy(g->request, request, size);
+    g->requestSize = size;
+    memcpy(g->cells, m->cells, m->cellCount / 4);
+    g->cellCount = m->cellCount;
+    g->width = m->width;
+    g->height = m->height;
+    g->startX = m->startX;
+    g->startY = m->startY;
+    g->destX = m->destX;
+    g->destY = m->destY;
+    g->lineCount = hasLines ? m->lineCount : 0;
+    for (uint i = 0; hasLines && i <= m->lineCount; i++)
+        g->lines[i] = m->lines[i] - m->text;
+    g->bytes = bytes;
+    g->users = 0;
+    g->dropped = false;
+
+    pthread_mutex_lock(&c->lock);
+    while (c->oldest && c->bytes + bytes > c->limit)
+        dropOldest(c);
+    CachedGrid **bucket = &c->buckets[hash % CACHEBUCKETS];
+    g->nextInBucket = *bucket;
+    *bucket = g;
+    linkGrid(c, g);
+    c->bytes += bytes;
+    pthread_mutex_unlock(&c->lock);
+}
+
+struct Server {
+    Settings settings;
+    GridCache cache;
+    size_t requestLimit;
+    // Connections being answered, at most connectionLimit.  closed is
+    // signalled as each one ends.
+    pthread_mutex_t lock;
+    pthread_cond_t closed;
+    uint connections, connectionLimit;
+};
+
+struct Connection {
+    Server *server;
+    int fd;
+    maze m;
+    Buffer request, answer;
+};
+
+/**
+ * read() exactly size bytes from fd into data.
+ * @return false at the end of the connection or on an error
+ */
+bool readFully(int fd, char *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t got = read(fd, data, size);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        data += got;
+        size -= got;
+    }
+    return true;
+}
+
+/**
+ * Parse (or look up), solve and write out the maze in the request of
+ * connection c into out.
+ * @return the status of the answer
+ */
+ANSWER answer(Connection * c, FILE * out)
+{
+    maze *m = &c->m;
+    Server *s = c->server;
+    m->width = m->height = 0;
+    m->marks.count = 0;
+    m->text = c->request.data;
+    m->textSize = c->request.size;
+    m->textMapped = false;
+    m->textShared = true;
+
+    uint64_t hash = 0;
+    bool cached = false;
+    if (s->cache.limit > 0) {
+        hash = hashBytes(m->text, m->textSize);
+        cached = lookUpGrid(&s->cache, m, hash, m->text, m->textSize);
+        // A packed maze is drawn out from its cells, like parse() does
+        if (cached && m->text[0] == MAZEFILE_MAGIC[0]) {
+            m->text = NULL;
+            if (!m->redraw)
+                buildText(m);
+        } else if (cached && m->redraw) {
+            m->text = NULL;
+        }
+    }
+    if (!cached) {
+        if (!parse(m))
+            return UNREADABLE;
+        if (s->cache.limit > 0)
+            cacheGrid(&s->cache, m, hash, c->request.data, c->request.size);
+    }
+    if (!solve(m, &s->settings))
+        return NOPATH;
+    return writeSolved(m, &s->settings, out) ? SOLVED : FAILED;
+}
+
+/**
+ * Let go of connection c and make room for the next one.
+ */
+void endConnection(Connection * c)
+{
+    Server *s = c->server;
+    delete c;
+    pthread_mutex_lock(&s->lock);
+    s->connections--;
+    pthread_cond_signal(&s->closed);
+    pthread_mutex_unlock(&s->lock);
+}
+
+/**
+ * Answer every request on a connection until it is closed.
+ */
+void *connectionThread(void *arg)
+{
+    Connection *c = (Connection *) arg;
+    cookie_io_functions_t functions = { NULL, writeBuffer, NULL, NULL };
+    FILE *out = fopencookie(&c->answer, "w", functions);
+    unsigned char header[8];
+    while (out && readFully(c->fd, (char *) header, 4)) {
+        size_t size = mazeFileGet32(header);
+        if (size == 0 || size > c->server->requestLimit
+            || !reserve(&c->request, size)
+            || !readFully(c->fd, c->request.data, size))
+            break;
+        c->request.size = size;
+
+        c->answer.size = 0;
+        ANSWER status = answer(c, out);
+        if (fflush(out) != 0 || ferror(out)) {
+            // Out of memory for the answer
+            if (status == SOLVED)
+                status = FAILED;
+            clearerr(out);
+        }
+        freeText(&c->m);
+        if (status != SOLVED)
+            c->answer.size = 0;
+        mazeFilePut32(header, status);
+        mazeFilePut32(header + 4, c->answer.size);
+        struct iovec iov[2];
+        iov[0].iov_base = header;
+        iov[0].iov_len = 8;
+        iov[1].iov_base = c->answer.data;
+        iov[1].iov_len = c->answer.size;
+        if (!writeAll(c->fd, iov, 2))
+            break;
+    }
+    if (out)
+        fclose(out);
+    close(c->fd);
+    freeMaze(&c->m);
+    free(c->request.data);
+    free(c->answer.data);
+    endConnection(c);
+    return NULL;
+}
+
+/**
+ * Listen on the Unix socket at path and answer requests of up to
+ * requestLimit bytes on up to connectionLimit connections at once until
+ * killed.
+ * @return false if the socket couldn't be set up
+ */
+bool serve(Settings * settings, const char *path, size_t cacheBytes,
+           size_t requestLimit, uint connectionLimit)
+{
+    struct sockaddr_un address;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long.\n", path);
+        return false;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    // Only a socket left by an earlier server is taken over
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "%s is already there and isn't a socket.\n",
+                    path);
+            return false;
+        }
+        unlink(path);
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0
+        || bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0
+        || listen(listener, SOMAXCONN) != 0) {
+        perror(path);
+        if (listener >= 0)
+            close(listener);
+        return false;
+    }
+    // A caller going away shouldn't take the server with it
+    signal(SIGPIPE, SIG_IGN);
+
+    Server *server = new Server;
+    server->settings = *settings;
+    memset(server->cache.buckets, 0, sizeof(server->cache.buckets));
+    server->cache.newest = server->cache.oldest = NULL;
+    server->cache.bytes = 0;
+    server->cache.limit = cacheBytes;
+    pthread_mutex_init(&server->cache.lock, NULL);
+    server->requestLimit = requestLimit;
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->closed, NULL);
+    server->connections = 0;
+    server->connectionLimit = connectionLimit;
+
+    pthread_attr_t detached;
+    pthread_attr_init(&detached);
+    pthread_attr_setdetachstate(&detached, PTHREAD_CREATE_DETACHED);
+    for (;;) {
+        // Leave more connections waiting to be accepted until one closes
+        pthread_mutex_lock(&server->lock);
+        while (server->connections >= server->connectionLimit)
+            pthread_cond_wait(&server->closed, &server->lock);
+        pthread_mutex_unlock(&server->lock);
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno == EMFILE || errno == ENFILE) {
+                // Wait for a connection to close
+                usleep(10000);
+                continue;
+            }
+            perror("solmaze: accept");
+            break;
+        }
+        pthread_mutex_lock(&server->lock);
+        server->connections++;
+        pthread_mutex_unlock(&server->lock);
+        Connection *c = new Connection;
+        c->server = server;
+        c->fd = fd;
+        initMaze(&c->m, settings->redraw);
+        c->request.data = c->answer.data = NULL;
+        c->request.size = c->request.capacity = 0;
+        c->answer.size = c->answer.capacity = 0;
+        pthread_t thread;
+        if (pthread_create(&thread, &detached, connectionThread, c) != 0) {
+            close(fd);
+            freeMaze(&c->m);
+            endConnection(c);
+        }
+    }
+    close(listener);
+    return false;
+}
+
+/*
+ * Answering queries:
+ *
+ * A perfect maze is a tree, so with --query the maze is walked depth first
+ * once from the start.  Each cell is numbered in the order it is first
+ * reached, and the walk keeps how deep each cell is and the way back to
+ * its parent.  For two cells numbered a < b, the shallowest cell numbered
+ * in (a, b] is a child of the cell where their ways back meet.  Each query
+ * is therefore a range minimum.  It is answered in O(1) from two sources:
+ * the shallowest cell of every power of two run of QUERYBLOCK blocks, and
+ * inside a block, a mask of which earlier cells are still the shallowest.
+ * The distance comes straight from the depths, and the path is walked
+ * back from both ends to where they meet.  With loops only the ways the
+ * walk took are used, so the path may not be the shortest.
+ */
+
+// Cells in a block of the range minimum, one for each bit of a mask
+#define QUERYBLOCK 32
+
+// What to answer each query with
+enum QUERYANSWER { DISTANCE, PATH, DISTANCEANDPATH };
+
+struct QueryIndex {
+    maze *m;
+    // Cells in the maze, each numbered y * width + x
+    uint32_t count;
+    // The order each cell was first reached in
+    uint32_t *order;
+    // For each order: the cell reached, its depth and which cells of its
+    // block up to it are shallower than everything after them
+    uint32_t *reached;
+    uint32_t *depth;
+    uint32_t *mask;
+    // The index in tryOrder of the way each cell was entered from its
+    // parent, two bits a cell
+    unsigned char *parents;
+    // The shallowest order in each run of 1 << level blocks
+    uint32_t **table;
+    uint levels;
+};
+
+/**
+ * @return how far the number of cell moves going dir
+ */
+inline ptrdiff_t nodeOffset(maze * m, int dir)
+{
+    switch (dir) {
+    case UP:    return -(ptrdiff_t) m->width;
+    case DOWN:  return m->width;
+    case LEFT:  return -1;
+    default:    return 1;
+    }
+}
+
+/**
+ * @return the way cell number node of q was entered from its parent
+ */
+inline int parentWay(QueryIndex * q, uint32_t node)
+{
+    return tryOrder[(q->parents[node / 4] >> ((node % 4) * 2)) & 3];
+}
+
+/**
+ * Walk the tree of q depth first from cell (x,y), numbering every cell it
+ * reaches from next on.
+ * @return the next number after them
+ */
+uint32_t walkTree(QueryIndex * q, uint x, uint y, uint32_t next)
+{
+    maze *m = q->m;
+    ptrdiff_t offset[4];
+    tryOffsets(m, offset);
+    ptrdiff_t nodeOffsets[4];
+    for (int i = 0; i < 4; i++)
+        nodeOffsets[i] = nodeOffset(m, tryOrder[i]);
+
+    size_t capacity = STACKBLOCK;
+    size_t depth = 0;
+    unsigned char *stack = (unsigned char *) malloc(capacity);
+    size_t at = cellAt(m, x, y);
+    uint32_t node = y * m->width + x;
+    visit(m, at);
+    q->order[node] = next;
+    q->reached[next] = node;
+    q->depth[next++] = 0;
+    // The from of a frame here is the index in tryOrder it came in by
+    stack[depth++] = FRAME(0, 0);
+    while (depth > 0) {
+        unsigned char frame = stack[depth - 1];
+        uint tried = FRAMETRIED(frame);
+        int cell = ways(m, at);
+        while (tried < 4 && (!(cell & tryOrder[tried])
+                             || isVisited(m, at + offset[tried])))
+            tried++;
+        if (tried == 4) {
+            // Back up to the parent
+            uint from = FRAMEFROM(frame);
+            at -= offset[from];
+            node -= nodeOffsets[from];
+            depth--;
+            continue;
+        }
+        stack[depth - 1] = FRAME(FRAMEFROM(frame), tried + 1);
+        at += offset[tried];
+        node += nodeOffsets[tried];
+        visit(m, at);
+        q->parents[node / 4] |= tried << ((node % 4) * 2);
+        q->order[node] = next;
+        q->reached[next] = node;
+        q->depth[next++] = depth;
+        if (depth == capacity) {
+            capacity *= 2;
+            stack = (unsigned char *) realloc(stack, capacity);
+        }
+        stack[depth++] = FRAME(tried, 0);
+    }
+    free(stack);
+    return next;
+}
+
+/**
+ * @return whichever of orders a and b of q is shallower
+ */
+inline uint32_t shallower(QueryIndex * q, uint32_t a, uint32_t b)
+{
+    return (q->depth[b] < q->depth[a]) ? b : a;
+}
+
+/**
+ * @return the shallowest order from first to last of q, both in one block
+ */
+inline uint32_t blockMinimum(QueryIndex * q, uint32_t first, uint32_t last)
+{
+    uint32_t start = first / QUERYBLOCK * QUERYBLOCK;
+    uint32_t bits = q->mask[last] & (~0U << (first - start));
+    return start + __builtin_ctz(bits);
+}
+
+/**
+ * @return the shallowest order from first to last of q
+ */
+uint32_t rangeMinimum(QueryIndex * q, uint32_t first, uint32_t last)
+{
+    uint32_t firstBlock = first / QUERYBLOCK;
+    uint32_t lastBlock = last / QUERYBLOCK;
+    if (firstBlock == lastBlock)
+        return blockMinimum(q, first, last);
+    uint32_t best = shallower(q,
+        blockMinimum(q, first, firstBlock * QUERYBLOCK + QUERYBLOCK - 1),
+        blockMinimum(q, lastBlock * QUERYBLOCK, last));
+    if (firstBlock + 1 < lastBlock) {
+        uint32_t blocks = lastBlock - firstBlock - 1;
+        uint level = 31 - __builtin_clz(blocks);
+        best = shallower(q, best, q->table[level][firstBlock + 1]);
+        best = shallower(q, best,
+                         q->table[level][lastBlock - (1U << level)]);
+    }
+    return best;
+}
+
+/**
+ * Build the index of maze m into q.
+ * @return false if there isn't enough memory
+ */
+bool buildIndex(QueryIndex * q, maze * m)
+{
+    q->m = m;
+    q->count = m->width * (m->height + 1);
+    q->order = (uint32_t *) malloc(q->count * sizeof(uint32_t));
+    q->reached = (uint32_t *) malloc(q->count * sizeof(uint32_t));
+    q->depth = (uint32_t *) malloc(q->count * sizeof(uint32_t));
+    q->mask = (uint32_t *) malloc(q->count * sizeof(uint32_t));
+    q->parents = (unsigned char *) calloc(q->count / 4 + 1, 1);
+    q->table = NULL;
+    q->levels = 0;
+    if (!q->order || !q->reached || !q->depth || !q->mask || !q->parents) {
+        fprintf(stderr, "Not enough memory to index the maze.\n");
+        return false;
+    }
+
+    // The start first, then anything it doesn't reach
+    uint32_t next = walkTree(q, m->startX, m->startY, 0);
+    for (uint y = 0; y <= m->height && next < q->count; y++)
+        for (uint x = 0; x < m->width; x++)
+            if (!isVisited(m, cellAt(m, x, y)))
+                next = walkTree(q, x, y, next);
+
+    // Which cells are still the shallowest, like a stack of them
+    for (uint32_t i = 0; i < q->count; i++) {
+        uint32_t start = i / QUERYBLOCK * QUERYBLOCK;
+        uint32_t bits = (i == start) ? 0 : q->mask[i - 1];
+        while (bits && q->depth[start + 31 - __builtin_clz(bits)]
+               >= q->depth[i])
+            bits &= ~(1U << (31 - __builtin_clz(bits)));
+        q->mask[i] = bits | (1U << (i - start));
+    }
+
+    uint32_t blocks = (q->count + QUERYBLOCK - 1) / QUERYBLOCK;
+    while ((1U << q->levels) <= blocks)
+        q->levels++;
+    q->table = new uint32_t *[q->levels];
+    for (uint level = 0; level < q->levels; level++) {
+        uint32_t runs = blocks - (1U << level) + 1;
+        q->table[level] = (uint32_t *) malloc(runs * sizeof(uint32_t));
+        if (q->table[level] == NULL) {
+            q->levels = level;
+            fprintf(stderr, "Not enough memory to index the maze.\n");
+            return false;
+        }
+        for (uint32_t b = 0; b < runs; b++) {
+            if (level == 0) {
+                uint32_t last = b * QUERYBLOCK + QUERYBLOCK - 1;
+                q->table[0][b] = blockMinimum(q, b * QUERYBLOCK,
+                    last < q->count ? last : q->count - 1);
+            } else {
+                uint32_t half = 1U << (level - 1);
+                q->table[level][b] = shallower(q, q->table[level - 1][b],
+                                               q->table[level - 1][b + half]);
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Release what q holds.
+ */
+void freeIndex(QueryIndex * q)
+{
+    for (uint level = 0; level < q->levels; level++)
+        free(q->table[level]);
+    delete[]q->table;
+    free(q->order);
+    free(q->reached);
+    free(q->depth);
+    free(q->mask);
+    free(q->parents);
+}
+
+/**
+ * Find the path in q from cell number from to cell number to, putting the
+ * moves in moves (room for at least the distance).
+ * @return the distance, or -1 if they aren't connected
+ */
+long long findPath(QueryIndex * q, uint32_t from, uint32_t to,
+                   unsigned char *moves)
+{
+    if (from == to)
+        return 0;
+    uint32_t a = q->order[from], b = q->order[to];
+    uint32_t lowest = rangeMinimum(q, (a < b ? a : b) + 1, a < b ? b : a);
+    if (q->depth[lowest] == 0)
+        return -1;
+    uint32_t meetDepth = q->depth[lowest] - 1;
+    uint32_t up = q->depth[a] - meetDepth;
+    uint32_t down = q->depth[b] - meetDepth;
+    if (moves) {
+        // Up from from, then down to to filled in from the end
+        maze *m = q->m;
+        for (uint32_t i = 0; i < up; i++) {
+            int way = parentWay(q, from);
+            moves[i] = opposite(way);
+            from -= nodeOffset(m, way);
+        }
+        for (uint32_t i = 0; i < down; i++) {
+            int way = parentWay(q, to);
+            moves[up + down - 1 - i] = way;
+            to -= nodeOffset(m, way);
+        }
+    }
+    return (long long) up + down;
+}
+
+/**
+ * Answer each "(x1,y1) (x2,y2)" line from in on out with what.
+ */
+void answerQueries(QueryIndex * q, FILE * in, FILE * out, QUERYANSWER what)
+{
+    maze *m = q->m;
+    char *line = NULL;
+    size_t lineSize = 0;
+    size_t movesSize = 0;
+    unsigned char *moves = NULL;
+    while (getline(&line, &lineSize, in) > 0) {
+        uint x1, y1, x2, y2;
+        if (sscanf(line, " ( %u , %u ) ( %u , %u )", &x1, &y1, &x2, &y2) != 4
+            || x1 >= m->width || x2 >= m->width
+            || y1 > m->height || y2 > m->height) {
+            fprintf(out, "invalid\n");
+            continue;
+        }
+        uint32_t from = y1 * m->width + x1;
+        uint32_t to = y2 * m->width + x2;
+        long long distance = findPath(q, from, to, NULL);
+        if (distance < 0) {
+            fprintf(out, "none\n");
+            continue;
+        }
+        if (what != PATH)
+            fprintf(out, "%lld", distance);
+        if (what != DISTANCE && distance > 0) {
+            if ((size_t) distance > movesSize) {
+                movesSize = distance;
+                moves = (unsigned char *) realloc(moves, movesSize);
+            }
+            findPath(q, from, to, moves);
+            if (what == DISTANCEANDPATH)
+                fputc(' ', out);
+            writeMoves(moves, distance, out);
+        }
+        fputc('\n', out);
+    }
+    free(line);
+    free(moves);
+}
+
+/**
+ * Read the maze in file path, index it and answer the queries on stdin.
+ * @return false if the maze couldn't be read or indexed
+ */
+bool query(const char *path, QUERYANSWER what)
+{
+    maze m;
+    // Only the cells are needed, not the text
+    initMaze(&m, true);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return false;
+    }
+    bool ok = readInput(&m, fd) && parse(&m);
+    close(fd);
+    if (ok && (uint64_t) m.width * (m.height + 1) >= (1ULL << 32)) {
+        fprintf(stderr, "%s is too big to index.\n", path);
+        ok = false;
+    }
+    QueryIndex q;
+    if (ok) {
+        ok = buildIndex(&q, &m);
+        if (ok)
+            answerQueries(&q, stdin, stdout, what);
+        freeIndex(&q);
+    }
+    freeMaze(&m);
+    return ok;
+}
+
+/**
+ * Read a whole number from 1 to max out of text into count.
+ * @return false if text isn't one
+ */
+bool parseCount(const char *text, long max, uint * count)
+{
+    char *end;
+    errno = 0;
+    long n = strtol(text, &end, 10);
+    if (errno != 0 || end == text || *end != '\0' || n < 1 || n > max)
+        return false;
+    *count = n;
+    return true;
+}
+
+/**
+ * Read in an ascii maze, solve it and output it with the solution.
+ * @return 0 if it was solved, 1 if there is no path found and 2 if no
+ * maze could be read.
+ */
+int main(int argc, char *argv[])
+{
+    SOLVER solver = DFS;
+    bool bothEnds = false;
+    bool scalar = false;
+    bool redraw = false;
+    bool batch = false;
+    const char *socketPath = NULL;
+    const char *queryPath = NULL;
+    QUERYANSWER queryAnswer = DISTANCEANDPATH;
+    size_t cacheBytes = (size_t) 64 << 20;
+    uint requestMegabytes = 256;
+    uint connectionLimit = 64;
+    uint threadCount = 0;
+    OUTPUT output = MAZE;
+    char **paths = new char *[argc];
+    int pathCount = 0;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-') {
+            paths[pathCount++] = argv[i];
+            continue;
+        }
+        if (0 == strcmp(argv[i], "--batch")) {
+            batch = true;
+            continue;
+        }
+        if (0 == strcmp(argv[i], "--serve") && i + 1 < argc) {
+            socketPath = argv[++i];
+            continue;
+        }
+        if (0 == strcmp(argv[i], "--max-request") && i + 1 < argc
+            && parseCount(argv[i + 1], 4095, &requestMegabytes)) {
+            i++;
+            continue;
+        }
+        if (0 == strcmp(argv[i], "--connections") && i + 1 < argc
+            && parseCount(argv[i + 1], 4096, &connectionLimit)) {
+            i++;
+            continue;
+        }
+        if (0 == strcmp(argv[i], "--cache") && i + 1 < argc) {
+            cacheBytes = (size_t) atoi(argv[++i]) << 20;
+            continue;
+        }
+        if (0 == strcmp(argv[i], "--query") && i + 1 < argc) {
+            queryPath = argv[++i];
+            continue;
+        }
+        if (0 == strcmp(argv[i], "--answer") && i + 1 < argc) {
+            const char *name = argv[++i];
+            if (0 == strcmp(name, "distance")) {
+                queryAnswer = DISTANCE;
+                continue;
+            }
+            if (0 == strcmp(name, "path")) {
+                queryAnswer = PATH;
+                continue;
+            }
+            if (0 == strcmp(name, "both")) {
+                queryAnswer = DISTANCEANDPATH;
+                continue;
+            }
+        }
+        if (0 == strcmp(argv[i], "--both")) {
+            bothEnds = true;
+            continue;
+        }
+        if (0 == strcmp(argv[i], "--scalar")) {
+            scalar = true;
+            continue;
+        }
+        if (0 == strcmp(argv[i], "--redraw")) {
+            redraw = true;
+            continue;
+        }
+        if (0 == strcmp(argv[i], "--path") && i + 1 < argc) {
+            const char *name = argv[++i];
+            // The text isn't needed to write just the path either
+            redraw = true;
+            if (0 == strcmp(name, "coords")) {
+                output = COORDINATES;
+                continue;
+            }
+            if (0 == strcmp(name, "moves")) {
+                output = MOVES;
+                continue;
+            }
+            if (0 == strcmp(name, "packed")) {
+                output = PACKEDPATH;
+                continue;
+            }
+        }
+        if (0 == strcmp(argv[i], "--solver") && i + 1 < argc) {
+            const char *name = argv[++i];
+            if (0 == strcmp(name, "dfs")) {
+                solver = DFS;
+                continue;
+            }
+            if (0 == strcmp(name, "bfs")) {
+                solver = BFS;
+                continue;
+            }
+            if (0 == strcmp(name, "astar")) {
+                solver = ASTAR;
+                continue;
+            }
+            if (0 == strcmp(name, "fill")) {
+                solver = FILL;
+                continue;
+            }
+            if (0 == strcmp(name, "tiles")) {
+                solver = TILES;
+                continue;
+            }
+        }
+        if (0 == strcmp(argv[i], "--threads") && i + 1 < argc
+            && parseCount(argv[i + 1], 4096, &threadCount)) {
+            i++;
+            continue;
+        }
+        fprintf(stderr, "Usage: %s [OPTIONS] < maze\n", argv[0]);
+        fprintf(stderr, "       %s --batch [OPTIONS] [FILE|DIRECTORY]...\n",
+                argv[0]);
+        fprintf(stderr, "       %s --serve SOCKET [OPTIONS]\n", argv[0]);
+        fprintf(stderr, "       %s --query MAZE [--answer distance|path|both]"
+                        " < queries\n", argv[0]);
+        fprintf(stderr, "\t--solver dfs|bfs|astar|fill|tiles - How to look for\n"
+                        "\t          the path.  dfs (default) finds a path, bfs and\n"
+                        "\t          astar always find a shortest one when the maze\n"
+                        "\t          has loops, astar looking at fewer cells.  fill\n"
+                        "\t          fills in dead ends until only the path is left.\n"
+                        "\t          tiles searches 256x256 tiles on many threads\n"
+                        "\t          and joins them up.\n");
+        fprintf(stderr, "\t--threads N - Threads for the tiles solver or\n"
+                        "\t          --batch, 1 to 4096 (default one per\n"
+                        "\t          processor).\n");
+        fprintf(stderr, "\t--batch - Solve every maze in the files (or\n"
+                        "\t          directories of files) given, or on stdin\n"
+                        "\t          with a line starting with a form feed\n"
+                        "\t          between each, and write them out in order\n"
+                        "\t          the same way.\n");
+        fprintf(stderr, "\t--serve SOCKET - Answer mazes sent to a Unix\n"
+                        "\t          socket, each a 4 byte length and the maze.\n"
+                        "\t          Answers are a 4 byte status (0 solved, 1\n"
+                        "\t          unreadable, 2 no path, 3 failed to write the\n"
+                        "\t          answer), a 4 byte length and what would go\n"
+                        "\t          to stdout.\n");
+        fprintf(stderr, "\t--cache MB - Parsed mazes --serve keeps for when\n"
+                        "\t          they are sent again (default 64, 0 for\n"
+                        "\t          none).\n");
+        fprintf(stderr, "\t--max-request MB - Largest maze --serve takes\n"
+                        "\t          (default 256).\n");
+        fprintf(stderr, "\t--connections N - Connections --serve answers at\n"
+                        "\t          once, more wait to be accepted (default\n"
+                        "\t          64).\n");
+        fprintf(stderr, "\t--query MAZE - Index the maze in the file MAZE once\n"
+                        "\t          and answer each (x1,y1) (x2,y2) line on\n"
+                        "\t          stdin with how far apart the cells are\n"
+                        "\t          and/or the moves between them (see\n"
+                        "\t          --answer, default both).\n");
+        fprintf(stderr, "\t--both - Search from the start and the end at once\n"
+                        "\t          on two threads with dfs or bfs (with loops\n"
+                        "\t          the path may not be the shortest).\n");
+        fprintf(stderr, "\t--scalar - Don't use SSE2/AVX2 to find dead ends.\n");
+        fprintf(stderr, "\t--redraw - Let go of the input once it is read and\n"
+                        "\t          draw the maze back out from its cells the\n"
+                        "\t          way genmaze draws it.\n");
+        fprintf(stderr, "\t--path coords|moves|packed - Only write the path,\n"
+                        "\t          as the (x,y) of each cell, as runs of moves\n"
+                        "\t          (U3 R12 D1) or as 2 bit moves after a header\n"
+                        "\t          (see mazefile.h).\n");
+        delete[]paths;
+        return 1;
+    }
+    if (bothEnds && solver != DFS && solver != BFS) {
+        fprintf(stderr, "--both only works with the dfs and bfs solvers.\n");
+        delete[]paths;
+        return 1;
+    }
+    if ((socketPath != NULL) + batch + (queryPath != NULL) > 1) {
+        fprintf(stderr, "Only one of --serve, --batch and --query can be "
+                        "used.\n");
+        delete[]paths;
+        return 1;
+    }
+    if (pathCount > 0 && !batch) {
+        fprintf(stderr, "Mazes are only named with --batch, a single maze "
+                        "is read from stdin.\n");
+        delete[]paths;
+        return 1;
+    }
+    if (threadCount == 0) {
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        threadCount = processors > 0 ? processors : 1;
+    }
+    Settings settings = { solver, bothEnds, scalar, redraw, threadCount,
+                          output };
+    if (batch) {
+        bool solvedAll = solveBatch(&settings, paths, pathCount);
+        delete[]paths;
+        return solvedAll ? 0 : 1;
+    }
+    delete[]paths;
+    if (socketPath)
+        return serve(&settings, socketPath, cacheBytes,
+                     (size_t) requestMegabytes << 20, connectionLimit) ? 0 : 1;
+    if (queryPath)
+        return query(queryPath, queryAnswer) ? 0 : 1;
+
+    maze m;
+    initMaze(&m, redraw);
+
+    // Read the maze
+    if (!read(&m)) {
+        fprintf(stderr, "Couldn't read a maze from stdin.\n");
+        freeMaze(&m);
+        return 2;
+    }
+
+    // Attempt to find the solution
+    int isSolvable = solve(&m, &settings);
+    if (solver == ASTAR)
+        fprintf(stderr, "%lu cells expanded.\n", (unsigned long) m.expanded);
     if (isSolvable)
-        write(&m);
+        isSolvable = writeSolved(&m, &settings, stdout);
     else
         fprintf(stderr, "No path found through maze.\n");
 
     // Memory cleanup
-    for (uint row = 0; row <= m.height; row++)
-        delete[](m.rows[row]);
+    freeMaze(&m);
 
-    return isSolvable;
+    return isSolvable ? 0 : 1;
 }
@@ -1,5 +1,7 @@
-CONFIG   = qt warn_on debug quick-app
-#CONFIG    = qt warn_on release 
-LIBS 			+= -lreadline
+CONFIG   = console warn_on debug thread
+#CONFIG    = console warn_on release thread
+QT       -= core gui
 SOURCES   = solmaze.cpp
 TARGET    = solmaze
+INCLUDEPATH += ../common
+HEADERS   = ../common/mazefile.h
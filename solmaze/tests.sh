@@ -0,0 +1,68 @@
+#!/bin/sh
+#
+# Checks of solmaze's exit codes and command line.
+#
+# Usage: tests.sh [path to solmaze]
+
+SOLMAZE=$(cd "$(dirname "${1:-./solmaze}")" && pwd)/$(basename "${1:-./solmaze}")
+SAMPLES=$(cd "$(dirname "$0")/../sample-mazes" && pwd)
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+FAILED=0
+
+fail() {
+    echo "FAIL: $1"
+    FAILED=1
+}
+
+# expect CODE DESCRIPTION COMMAND... - run COMMAND and check its exit code
+expect() {
+    code=$1
+    what=$2
+    shift 2
+    "$@" > /dev/null 2> errors.txt
+    got=$?
+    [ $got = $code ] || fail "$what exited $got instead of $code"
+}
+
+expect 0 "a sample maze" sh -c "'$SOLMAZE' < '$SAMPLES/input0.txt'"
+"$SOLMAZE" < "$SAMPLES/input0.txt" | cmp -s - "$SAMPLES/output0.txt" \
+    || fail "a sample maze isn't solved the same"
+
+: > empty.txt
+printf 'hello\nworld\n' > garbage.txt
+printf 'x\ny\nz\n' > short.txt
+# A packed header claiming a 40000x40000 maze with no rows after it
+{ printf 'AMZP\001\000\000\000\000\000\000\000'
+  printf '\100\234\000\000\100\234\000\000'
+  printf '\000\000\000\000\000\000\000\000\001\000\000\000\001\000\000\000'
+  printf '\000\000\000\000\000\000\000\000'; } > norows.bin
+for input in empty.txt garbage.txt short.txt norows.bin; do
+    expect 2 "$input" sh -c "'$SOLMAZE' < $input"
+    [ -s errors.txt ] || fail "$input gave no error message"
+done
+
+for count in -1 0 x 2x 99999999999; do
+    expect 1 "--threads $count" \
+        sh -c "'$SOLMAZE' --solver tiles --threads $count < '$SAMPLES/input0.txt'"
+done
+"$SOLMAZE" --solver tiles --threads 64 < "$SAMPLES/input0.txt" \
+    | cmp -s - "$SAMPLES/output0.txt" || fail "more threads than tiles"
+
+cp "$SAMPLES/input0.txt" "$SAMPLES/input1.txt" .
+expect 0 "--batch of sample mazes" "$SOLMAZE" --batch input0.txt input1.txt
+expect 1 "--batch with a missing file" \
+    "$SOLMAZE" --batch input0.txt /nonexistent input1.txt
+expect 1 "--batch to a full disk" \
+    sh -c "'$SOLMAZE' --batch input0.txt input1.txt > /dev/full"
+expect 1 "--batch with garbage" "$SOLMAZE" --batch input0.txt garbage.txt
+"$SOLMAZE" --batch input0.txt garbage.txt input1.txt > batch.txt 2> /dev/null
+{ cat "$SAMPLES/output0.txt"; printf '\f\n\f\n'; cat "$SAMPLES/output1.txt"; } \
+    | cmp -s - batch.txt || fail "--batch doesn't keep the mazes in order"
+
+expect 1 "--serve on a file" timeout 5 "$SOLMAZE" --serve garbage.txt
+printf 'hello\nworld\n' | cmp -s - garbage.txt || fail "--serve replaced a file"
+
+[ $FAILED = 0 ] && echo "All solmaze tests passed."
+exit $FAILED